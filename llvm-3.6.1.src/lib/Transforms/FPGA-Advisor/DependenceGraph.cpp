@@ -16,6 +16,11 @@
 //===----------------------------------------------------------------------===//
 
 #include "fpga_common.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
 
 #define DEBUG_TYPE "fpga-advisor-dependence"
 
@@ -38,6 +43,44 @@ static cl::opt<bool> PrintGraph("print-dg", cl::desc("Enable printing of depende
 
 static cl::opt<std::string> GraphName("dg-name", cl::desc("Dependence graph name"), cl::Hidden, cl::init("dg.dot"));
 
+static cl::opt<bool> UseDependenceAnalysis("dg-dependence-analysis", cl::desc("Use DependenceAnalysis for the dependences between loads and stores, so that loop carried dependences with a known distance only relate iterations that far apart"),
+		cl::Hidden, cl::init(false));
+
+// alias analyses that may be chained for the dependence graph, in the order
+// they are scheduled: the last one scheduled is asked first and passes the
+// queries it cannot answer on to the previous ones
+enum DepGraphAliasAnalysis {
+	CFLAA, TBAA, ScopedNoAliasAA, BasicAA, SCEVAA, NumDepGraphAliasAnalyses
+};
+
+static const char *AliasAnalysisNames[NumDepGraphAliasAnalyses] = {
+	"cfl-aa", "tbaa", "scoped-noalias", "basicaa", "scev-aa"
+};
+
+static cl::list<DepGraphAliasAnalysis> AliasAnalyses("dg-aa", cl::CommaSeparated, cl::desc("Alias analyses used by the dependence graph, basicaa is always included with any of them"),
+		cl::values(
+			clEnumValN(BasicAA, "basicaa", "Basic alias analysis"),
+			clEnumValN(TBAA, "tbaa", "Type based alias analysis, needs tbaa metadata"),
+			clEnumValN(ScopedNoAliasAA, "scoped-noalias", "Scoped noalias analysis, needs alias.scope and noalias metadata"),
+			clEnumValN(SCEVAA, "scev-aa", "ScalarEvolution based alias analysis"),
+			clEnumValN(CFLAA, "cfl-aa", "CFL based alias analysis"),
+			clEnumValEnd),
+		cl::Hidden);
+
+static cl::opt<bool> PrintReport("dg-report", cl::desc("Print the construction time and the dependences removed by the alias analyses for each function once the pass is done"),
+		cl::Hidden, cl::init(false));
+
+static cl::opt<std::string> CacheDirectory("dg-cache-dir", cl::desc("Directory where the dependence graph of each function is kept, so that later runs on the same function with the same alias analyses read it instead of constructing it"),
+		cl::Hidden, cl::init(""));
+
+// dependence graph cache files, see write_cached_graph
+static const char CacheMagic[] = "FPGADEPG";
+static const uint32_t CacheVersion = 4;
+// no carrier loop or producer instruction
+static const uint32_t CacheNone = ~0u;
+// a lock file older than this (in seconds) was left by a writer that died
+static const uint64_t CacheStaleLock = 60;
+
 //===----------------------------------------------------------------------===//
 // Helper functions
 //===----------------------------------------------------------------------===//
@@ -46,6 +89,48 @@ static cl::opt<std::string> GraphName("dg-name", cl::desc("Dependence graph name
 // DependenceGraph Class functions
 //===----------------------------------------------------------------------===//
 
+// Function: getAnalysisUsage
+// DependenceAnalysis gives up on any pair of accesses that the alias analysis
+// cannot tell apart, and the default of the AliasAnalysis group is no alias
+// analysis at all when the pass is run on the fly by a module pass. With
+// UseDependenceAnalysis or any AliasAnalyses the alias analyses are scheduled
+// first so that the last of them is the alias analysis found by the other
+// requirements. scev-aa is the only function pass among them, so it is found
+// before the others anyway and is scheduled last.
+void DependenceGraph::getAnalysisUsage(AnalysisUsage &AU) const {
+	AU.addPreserved<AliasAnalysis>();
+	AU.setPreservesAll();
+	AU.addRequired<DominatorTreeWrapperPass>();
+	if (UseDependenceAnalysis || !AliasAnalyses.empty()) {
+		for (unsigned aa = 0; aa < NumDepGraphAliasAnalyses; aa++) {
+			if (aa != BasicAA && std::find(AliasAnalyses.begin(), AliasAnalyses.end(), aa) == AliasAnalyses.end()) {
+				continue;
+			}
+			AU.addRequiredID(PassRegistry::getPassRegistry()->getPassInfo(StringRef(AliasAnalysisNames[aa]))->getTypeInfo());
+		}
+	}
+	AU.addRequiredTransitive<AliasAnalysis>();
+	//AU.addPreserved<MemoryDependenceAnalysis>();
+	AU.addRequiredTransitive<MemoryDependenceAnalysis>();
+	if (UseDependenceAnalysis) {
+		AU.addRequiredTransitive<DependenceAnalysis>();
+		AU.addRequired<LoopInfo>();
+	}
+}
+
+// Function: doInitialization
+bool DependenceGraph::doInitialization(Module &M) {
+	cacheEnabled = false;
+	if (!CacheDirectory.empty()) {
+		if (std::error_code EC = sys::fs::create_directories(CacheDirectory.getValue())) {
+			errs() << "Could not create dependence graph cache directory: " << CacheDirectory << " (" << EC.message() << ")!\n";
+		} else {
+			cacheEnabled = true;
+		}
+	}
+	return false;
+}
+
 // Function: runOnFunction
 bool DependenceGraph::runOnFunction(Function &F) {
 	//std::cerr << "runOnFunction: " << F.getName().str() << "\n";
@@ -58,13 +143,28 @@ bool DependenceGraph::runOnFunction(Function &F) {
 
 	if (F.isDeclaration()) return false;
 
+	clock_t start = clock();
+	currStats = &Stats[&F];
+	currStats->unknown = 0;
+	currStats->removed = 0;
+
 	func = &F;
-	DG.clear();
+	// the graph of the previous function may have been taken by
+	// takeDepGraph
+	DG.reset(new DepGraph());
 	NameVec.clear();
 	MemoryBBs.clear();
+	MemoryInsts.clear();
+	OtherMemoryBBs.clear();
 
 	// get analyses
 	MDA = &getAnalysis<MemoryDependenceAnalysis>();
+	DA = NULL;
+	LI = NULL;
+	if (UseDependenceAnalysis) {
+		DA = &getAnalysis<DependenceAnalysis>();
+		LI = &getAnalysis<LoopInfo>();
+	}
 	DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
 	// add each BB into DG
@@ -74,52 +174,432 @@ bool DependenceGraph::runOnFunction(Function &F) {
 	//}
 
 	// now process each vertex by adding edge to the vertex that
-	// the current vertex depends on
-	add_edges();
+	// the current vertex depends on, unless an earlier run already did
+	std::string cacheFile;
+	if (cacheEnabled) {
+		cacheFile = get_cache_file_name(F);
+	}
+	if (!cacheFile.empty() && read_cached_graph(cacheFile)) {
+		*outputLog << "Dependence graph read from cache file: " << cacheFile << "\n";
+		currStats->cached++;
+	} else {
+		currStats->runs++;
+		add_edges();
+		if (!cacheFile.empty()) {
+			write_cached_graph(cacheFile);
+		}
+	}
 	//boost::write_graphviz(std::cerr, DG);
 	if (PrintGraph) {
 		std::ofstream outfile(GraphName.c_str());
-		boost::write_graphviz(outfile, DG, boost::make_label_writer(&NameVec[0]));
+		boost::write_graphviz(outfile, *DG, boost::make_label_writer(&NameVec[0]));
+	}
+
+	currStats->memoryBBs = MemoryBBs.size();
+	currStats->edges = boost::num_edges(*DG);
+	currStats->time += ((double) clock() - (double) start) / CLOCKS_PER_SEC;
+	return true;
+}
+
+
+// Function: doFinalization
+bool DependenceGraph::doFinalization(Module &M) {
+	if (PrintReport) {
+		print_report(errs());
+	}
+	Stats.clear();
+	return false;
+}
+
+
+// Function: get_alias_analysis_configuration
+// Return: the alias analyses used, in the order they are asked
+std::string DependenceGraph::get_alias_analysis_configuration() {
+	std::string configuration;
+	if (UseDependenceAnalysis || !AliasAnalyses.empty()) {
+		for (unsigned aa = NumDepGraphAliasAnalyses; aa-- > 0; ) {
+			if (aa == BasicAA || std::find(AliasAnalyses.begin(), AliasAnalyses.end(), aa) != AliasAnalyses.end()) {
+				configuration += std::string(" ") + AliasAnalysisNames[aa];
+			}
+		}
+	} else {
+		configuration += " default";
+	}
+	if (UseDependenceAnalysis) {
+		configuration += ", with DependenceAnalysis";
+	}
+	return configuration;
+}
+
+
+// Function: print_attributes
+// Prints the attributes of each index of the set. The text of a function only
+// refers to its attribute groups by number.
+static void print_attributes(AttributeSet attributes, raw_ostream &OS) {
+	for (unsigned slot = 0; slot < attributes.getNumSlots(); slot++) {
+		unsigned index = attributes.getSlotIndex(slot);
+		OS << index << ": " << attributes.getAsString(index) << "\n";
+	}
+}
+
+
+// Function: print_metadata
+// Prints the contents of the node and of the nodes it refers to. The nodes are
+// numbered in the order they are reached, the text of a function only refers to
+// them by their number in the module.
+static void print_metadata(MDNode *node, DenseMap<MDNode *, unsigned> &nodes, raw_ostream &OS) {
+	if (!nodes.insert(std::make_pair(node, nodes.size())).second) {
+		return;
+	}
+	unsigned id = nodes[node];
+	std::vector<MDNode *> operands;
+	OS << "!" << id << " = !{";
+	for (unsigned i = 0; i < node->getNumOperands(); i++) {
+		Metadata *operand = node->getOperand(i);
+		if (i) {
+			OS << ", ";
+		}
+		if (!operand) {
+			OS << "null";
+		} else if (MDString *string = dyn_cast<MDString>(operand)) {
+			OS << "!\"" << string->getString() << "\"";
+		} else if (ValueAsMetadata *value = dyn_cast<ValueAsMetadata>(operand)) {
+			value->getValue()->printAsOperand(OS);
+		} else if (MDNode *child = dyn_cast<MDNode>(operand)) {
+			DenseMap<MDNode *, unsigned>::iterator it = nodes.find(child);
+			if (it == nodes.end()) {
+				OS << "!new";
+				operands.push_back(child);
+			} else {
+				OS << "!" << it->second;
+			}
+		}
+	}
+	OS << "}\n";
+	for (unsigned i = 0; i < operands.size(); i++) {
+		print_metadata(operands[i], nodes, OS);
+	}
+}
+
+
+// Function: get_cache_file_name
+// Return: the cache file of the dependence graph of F
+// The file is named after the MD5 hash of everything the graph is constructed
+// from: the text of F, the contents of the attribute groups and metadata it
+// refers to, the declarations of the functions it calls, the data layout and
+// target of the module and the alias analyses.
+std::string DependenceGraph::get_cache_file_name(Function &F) {
+	std::string text;
+	raw_string_ostream textStream(text);
+	F.print(textStream);
+	print_attributes(F.getAttributes(), textStream);
+	DenseMap<MDNode *, unsigned> nodes;
+	for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; I++) {
+		SmallVector<std::pair<unsigned, MDNode *>, 4> metadata;
+		I->getAllMetadataOtherThanDebugLoc(metadata);
+		for (unsigned i = 0; i < metadata.size(); i++) {
+			textStream << "metadata " << metadata[i].first << " ";
+			print_metadata(metadata[i].second, nodes, textStream);
+		}
+		CallSite CS(&*I);
+		if (!CS) {
+			continue;
+		}
+		textStream << "call site ";
+		print_attributes(CS.getAttributes(), textStream);
+		if (Function *callee = CS.getCalledFunction()) {
+			textStream << "callee " << callee->getName() << " ";
+			callee->getFunctionType()->print(textStream);
+			textStream << "\n";
+			print_attributes(callee->getAttributes(), textStream);
+		}
+	}
+	textStream.flush();
+
+	MD5 hash;
+	hash.update(StringRef(CacheMagic));
+	hash.update(ArrayRef<uint8_t>((const uint8_t *) &CacheVersion, sizeof(CacheVersion)));
+	hash.update(get_alias_analysis_configuration());
+	hash.update(F.getParent()->getDataLayoutStr());
+	hash.update(F.getParent()->getTargetTriple());
+	hash.update(text);
+	MD5::MD5Result result;
+	hash.final(result);
+	SmallString<32> key;
+	MD5::stringifyResult(result, key);
+
+	SmallString<128> fileName(CacheDirectory.getValue());
+	sys::path::append(fileName, key.str() + ".dg");
+	return fileName.str();
+}
+
+
+// Function: read_cached_graph
+// Return: false if the file does not exist or does not match the function
+// Adds the edges of the dependence graph from its cache file, the vertices must
+// have been added already
+bool DependenceGraph::read_cached_graph(StringRef fileName) {
+	using namespace support;
+	ErrorOr<std::unique_ptr<MemoryBuffer> > fileOrErr = MemoryBuffer::getFile(fileName);
+	if (!fileOrErr) {
+		return false;
+	}
+	MemoryBuffer &buffer = *fileOrErr.get();
+	const unsigned char *ptr = (const unsigned char *) buffer.getBufferStart();
+	const unsigned char *end = (const unsigned char *) buffer.getBufferEnd();
+	const size_t headerSize = sizeof(CacheMagic) - 1 + 5 * sizeof(uint32_t);
+	if (buffer.getBufferSize() < headerSize || memcmp(ptr, CacheMagic, sizeof(CacheMagic) - 1) != 0) {
+		*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+		return false;
+	}
+	ptr += sizeof(CacheMagic) - 1;
+	uint32_t version = endian::readNext<uint32_t, little, unaligned>(ptr);
+	uint32_t numVertices = endian::readNext<uint32_t, little, unaligned>(ptr);
+	uint32_t unknown = endian::readNext<uint32_t, little, unaligned>(ptr);
+	uint32_t removed = endian::readNext<uint32_t, little, unaligned>(ptr);
+	uint32_t numEdges = endian::readNext<uint32_t, little, unaligned>(ptr);
+	DepGraphIndex &index = (*DG)[boost::graph_bundle];
+	if (version != CacheVersion || numVertices != index.numVertices ||
+		(uint64_t) (end - ptr) / (6 * sizeof(uint32_t)) < numEdges) {
+		*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+		return false;
 	}
+
+	std::vector<Instruction *> instructions;
+	for (auto BB = func->begin(); BB != func->end(); BB++) {
+		for (auto I = BB->begin(); I != BB->end(); I++) {
+			instructions.push_back(I);
+		}
+	}
+
+	// check every edge before adding any of them
+	std::vector<std::pair<DepGraph_descriptor, DepGraph_descriptor> > vertices(numEdges);
+	std::vector<DepGraphEdge> edges(numEdges);
+	for (uint32_t e = 0; e < numEdges; e++) {
+		if ((size_t) (end - ptr) < 6 * sizeof(uint32_t)) {
+			*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+			return false;
+		}
+		uint32_t source = endian::readNext<uint32_t, little, unaligned>(ptr);
+		uint32_t target = endian::readNext<uint32_t, little, unaligned>(ptr);
+		uint32_t carrier = endian::readNext<uint32_t, little, unaligned>(ptr);
+		edges[e].distance = endian::readNext<uint32_t, little, unaligned>(ptr);
+		edges[e].memory = endian::readNext<uint32_t, little, unaligned>(ptr) != 0;
+		uint32_t numCauses = endian::readNext<uint32_t, little, unaligned>(ptr);
+		if (source >= numVertices || target >= numVertices || (carrier != CacheNone && carrier >= numVertices) ||
+			(uint64_t) (end - ptr) / (3 * sizeof(uint32_t)) < numCauses) {
+			*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+			return false;
+		}
+		vertices[e] = std::make_pair(source, target);
+		edges[e].carrier = carrier == CacheNone ? NULL : (*DG)[carrier];
+		for (uint32_t c = 0; c < numCauses; c++) {
+			uint32_t producer = endian::readNext<uint32_t, little, unaligned>(ptr);
+			uint32_t consumer = endian::readNext<uint32_t, little, unaligned>(ptr);
+			uint32_t kind = endian::readNext<uint32_t, little, unaligned>(ptr);
+			if ((producer != CacheNone && producer >= instructions.size()) || consumer >= instructions.size() || kind > DEP_UNKNOWN) {
+				*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+				return false;
+			}
+			DepGraphCause cause = {producer == CacheNone ? NULL : instructions[producer], instructions[consumer], (DepKind) kind};
+			edges[e].causes.push_back(cause);
+		}
+	}
+	if (ptr != end) {
+		*outputLog << "Ignoring broken dependence graph cache file: " << fileName << "\n";
+		return false;
+	}
+
+	for (uint32_t e = 0; e < numEdges; e++) {
+		add_dependence_edge(vertices[e].first, vertices[e].second, edges[e]);
+	}
+	currStats->unknown = unknown;
+	currStats->removed = removed;
 	return true;
 }
 
 
+// Function: write_cached_graph
+// Writes the edges of the dependence graph to its cache file. All fields are
+// little endian:
+//	magic (CacheMagic), uint32_t version, uint32_t number of vertices,
+//	uint32_t unknown dependences, uint32_t removed memory edges,
+//	uint32_t number of edges, edge*
+// Each edge is the uint32_t vertices of its source and target, the vertex of
+// the header of its carrier loop (or CacheNone), its distance, whether it is
+// only through memory and the number of its causes, followed by each cause:
+// the uint32_t instructions of its producer (or CacheNone) and consumer and
+// its DepKind. Vertices are numbered in the order of the basic blocks of the
+// function and instructions in their order in the function. Edges are in the
+// order of the out edges of each vertex, so that the graph read back is the
+// same.
+// The file is written under a temporary name and renamed, so readers see either
+// the whole file or no file. Writers of the same file create a lock file next
+// to it first, the others leave the writing to the one holding the lock.
+// LockFileManager works the same way but is not part of the tools the pass is
+// loaded into.
+void DependenceGraph::write_cached_graph(StringRef fileName) {
+	using namespace support;
+	std::string lockFile = fileName.str() + ".lock";
+	int lockFD;
+	if (sys::fs::openFileForWrite(lockFile, lockFD, sys::fs::F_Excl)) {
+		sys::fs::file_status status;
+		if (!sys::fs::status(lockFile, status) &&
+			sys::TimeValue::now().toEpochTime() > status.getLastModificationTime().toEpochTime() + CacheStaleLock) {
+			// the writer holding it has died, take its place
+			sys::fs::remove(lockFile);
+		}
+		if (sys::fs::openFileForWrite(lockFile, lockFD, sys::fs::F_Excl)) {
+			*outputLog << "Dependence graph cache file is being written by another process: " << fileName << "\n";
+			return;
+		}
+	}
+	// only the existence of the lock file matters
+	raw_fd_ostream lock(lockFD, true);
+	lock.close();
+
+	SmallString<128> tempFile;
+	int fd;
+	if (sys::fs::createUniqueFile(fileName + "-%%%%%%%%", fd, tempFile)) {
+		sys::fs::remove(lockFile);
+		return;
+	}
+
+	DenseMap<Instruction *, uint32_t> instructions;
+	for (auto BB = func->begin(); BB != func->end(); BB++) {
+		for (auto I = BB->begin(); I != BB->end(); I++) {
+			uint32_t id = instructions.size();
+			instructions[I] = id;
+		}
+	}
+
+	bool error;
+	{
+		raw_fd_ostream out(fd, true);
+		endian::Writer<little> LE(out);
+		DepGraphIndex &index = (*DG)[boost::graph_bundle];
+		out.write(CacheMagic, sizeof(CacheMagic) - 1);
+		LE.write<uint32_t>(CacheVersion);
+		LE.write<uint32_t>(index.numVertices);
+		LE.write<uint32_t>(currStats->unknown);
+		LE.write<uint32_t>(currStats->removed);
+		LE.write<uint32_t>(boost::num_edges(*DG));
+		DepGraph_edge_iterator ei, ee;
+		for (boost::tie(ei, ee) = boost::edges(*DG); ei != ee; ei++) {
+			const DepGraphEdge &edge = (*DG)[*ei];
+			LE.write<uint32_t>(boost::source(*ei, *DG));
+			LE.write<uint32_t>(boost::target(*ei, *DG));
+			LE.write<uint32_t>(edge.carrier ? get_vertex_descriptor_for_basic_block(edge.carrier, *DG) : CacheNone);
+			LE.write<uint32_t>(edge.distance);
+			LE.write<uint32_t>(edge.memory);
+			LE.write<uint32_t>(edge.causes.size());
+			for (auto it = edge.causes.begin(); it != edge.causes.end(); it++) {
+				LE.write<uint32_t>(it->producer ? instructions[it->producer] : CacheNone);
+				LE.write<uint32_t>(instructions[it->consumer]);
+				LE.write<uint32_t>(it->kind);
+			}
+		}
+		out.close();
+		error = out.has_error();
+		out.clear_error();
+	}
+
+	if (error || sys::fs::rename(tempFile.str(), fileName)) {
+		*outputLog << "Could not write dependence graph cache file: " << fileName << "\n";
+		sys::fs::remove(tempFile.str());
+	}
+	sys::fs::remove(lockFile);
+}
+
+
+// Function: print_report
+// Prints the statistics of each function analyzed with the alias analyses used.
+// Comparing the reports of runs with different -dg-aa shows what each alias
+// analysis costs and how many dependences it removes.
+void DependenceGraph::print_report(raw_ostream &OS) {
+	OS << "FPGA-Advisor Dependence Graph report, alias analyses:" << get_alias_analysis_configuration() << "\n";
+	OS << "function\truns\tcached\tseconds\tedges\tmemory blocks\tunknown dependences\tremoved memory edges\n";
+
+	DepGraphStats total = {0, 0.0, 0, 0, 0, 0, 0};
+	for (auto it = Stats.begin(); it != Stats.end(); it++) {
+		const DepGraphStats &stats = it->second;
+		OS << it->first->getName() << "\t" << stats.runs << "\t" << stats.cached << "\t" << format("%.6f", stats.time) << "\t"
+			<< stats.edges << "\t" << stats.memoryBBs << "\t" << stats.unknown << "\t" << stats.removed << "\n";
+		total.runs += stats.runs;
+		total.time += stats.time;
+		total.cached += stats.cached;
+		total.edges += stats.edges;
+		total.memoryBBs += stats.memoryBBs;
+		total.unknown += stats.unknown;
+		total.removed += stats.removed;
+	}
+	OS << "total\t" << total.runs << "\t" << total.cached << "\t" << format("%.6f", total.time) << "\t"
+		<< total.edges << "\t" << total.memoryBBs << "\t" << total.unknown << "\t" << total.removed << "\n";
+}
+
+
 void DependenceGraph::add_vertices(Function &F) {
 	for (auto BB = F.begin(); BB != F.end(); BB++) {
 		//bool memoryInst = false;
 		for (auto I = BB->begin(); I != BB->end(); I++) {
 			if (I->mayReadOrWriteMemory()) {
 				//memoryInst = true;
-				MemoryBBs.push_back(BB);
-				break;
+				if (MemoryBBs.empty() || MemoryBBs.back() != BB) {
+					MemoryBBs.push_back(BB);
+				}
+				if (isa<LoadInst>(I) || isa<StoreInst>(I)) {
+					MemoryInsts.push_back(I);
+				} else if (OtherMemoryBBs.empty() || OtherMemoryBBs.back() != BB) {
+					OtherMemoryBBs.push_back(BB);
+				}
 			}
 		}
-		DepGraph_descriptor currVertex = boost::add_vertex(DG);
-		DG[currVertex] = BB;
+		DepGraph_descriptor currVertex = boost::add_vertex(*DG);
+		(*DG)[currVertex] = BB;
+		(*DG)[boost::graph_bundle].vertex[BB] = currVertex;
 		NameVec.push_back(BB->getName().str());
 		//if (memoryInst) {
 			//MemoryBBs.push_back(currVertex);
 		//}
 	}
+
+	DepGraphIndex &index = (*DG)[boost::graph_bundle];
+	index.numVertices = boost::num_vertices(*DG);
+	index.dependent.clear();
+	index.dependent.resize(index.numVertices * index.numVertices);
+	index.loopCarried = false;
+	index.otherMemory.clear();
+	index.otherMemory.resize(index.numVertices);
+	for (auto BB = OtherMemoryBBs.begin(); BB != OtherMemoryBBs.end(); BB++) {
+		index.otherMemory.set(index.vertex[*BB]);
+	}
+	MemoryVertices.clear();
+	MemoryVertices.resize(index.numVertices);
+	for (auto BB = MemoryBBs.begin(); BB != MemoryBBs.end(); BB++) {
+		MemoryVertices.set(index.vertex[*BB]);
+	}
 }
 
 
 void DependenceGraph::add_edges() {
 	DepGraph_iterator vi, ve;
-	for (boost::tie(vi, ve) = vertices(DG); vi != ve; vi++) {
-		BasicBlock *currBB = DG[*vi];
+	for (boost::tie(vi, ve) = vertices(*DG); vi != ve; vi++) {
+		BasicBlock *currBB = (*DG)[*vi];
 		std::vector<BasicBlock *> depBBs;
+		currDeps.reset();
+		currDeps.resize(boost::num_vertices(*DG));
+		currEdges.resize(boost::num_vertices(*DG));
 		*outputLog << "******************************************************************************************************\n";
 		*outputLog << "Examining dependencies for basic block: " << currBB->getName() << "\n";
 		// analyze each instruction within the basic block
 		// for each operand, find the originating definition
 		// for each load/store operator, analyze the memory
 		// dependence
-		// TODO: I could set the edges to contain a list of
-		//	the instructions that caused the dependence
+		// each edge lists the instructions that caused the dependence
 		// Here we only consider true dependences
 		for (auto I = currBB->begin(); I != currBB->end(); I++) {
+			currInst = I;
+			currCauses.clear();
 			*outputLog << "===------------------------------------------------------------------------------------------------===\n";
 			*outputLog << "Looking at dependencies for instruction: ";
 			I->print(*outputLog);
@@ -136,7 +616,7 @@ void DependenceGraph::add_edges() {
 					*outputLog << "True dependence on instruction: ";
 					dep->print(*outputLog);
 					*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
-					insert_dependent_basic_block(depBBs, depBB);
+					insert_dependent_basic_block(depBBs, depBB, dep, DEP_SSA);
 				}
 			}
 
@@ -154,6 +634,11 @@ void DependenceGraph::add_edges() {
 					continue;
 				}
 
+				if (DA && (isa<LoadInst>(I) || isa<StoreInst>(I))) {
+					add_memory_dependences(I, depBBs);
+					continue;
+				}
+
 				// take a look only at local and non-local dependencies
 				// local (within the same basic block) dependencies will matter
 				// if control flow ever iterates through the same basic block more
@@ -174,13 +659,19 @@ void DependenceGraph::add_edges() {
 						NonLocalDepResult NLDR = *qi;
 						const MemDepResult nonLocalMDR = NLDR.getResult();
 						Instruction *dep = nonLocalMDR.getInst();
+						// nothing on the paths through this block up to
+						// the function entry, which better alias analyses
+						// find more often
+						if (nonLocalMDR.isNonFuncLocal()) {
+							continue;
+						}
 						if (nonLocalMDR.isUnknown() || dep == NULL) {
 							*outputLog << "Unknown/Other type dependence!!! Adding dependence to all basic blocks.\n";
 							insert_dependent_basic_block_all_memory(depBBs);
 							break;
 						}
 						BasicBlock *depBB = dep->getParent();
-						insert_dependent_basic_block(depBBs, depBB);
+						insert_dependent_basic_block(depBBs, depBB, dep, get_memory_dependence_kind(dep, I));
 
 						*outputLog << "Memory instruction dependent on: ";
 						dep->print(*outputLog);
@@ -198,7 +689,7 @@ void DependenceGraph::add_edges() {
 					*outputLog << "Memory instruction dependent on: ";
 					dep->print(*outputLog);
 					*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
-					insert_dependent_basic_block(depBBs, depBB);
+					insert_dependent_basic_block(depBBs, depBB, dep, get_memory_dependence_kind(dep, I));
 				}
 			}
 		}
@@ -206,43 +697,228 @@ void DependenceGraph::add_edges() {
 		// add all the dependent edges
 		for (auto di = depBBs.begin(); di != depBBs.end(); di++) {
 			BasicBlock *depBB = *di;
-			DepGraph_descriptor depVertex = get_vertex_descriptor_for_basic_block(depBB, DG);
-			DepGraph_descriptor currVertex = get_vertex_descriptor_for_basic_block(currBB, DG);
-			boost::add_edge(currVertex, depVertex, DG);
+			DepGraph_descriptor depVertex = get_vertex_descriptor_for_basic_block(depBB, *DG);
+			add_dependence_edge(*vi, depVertex, currEdges[depVertex]);
 		}
+		count_removed_memory_dependences(currBB);
 	}
 }
 
 
-DepGraph_descriptor DependenceGraph::get_vertex_descriptor_for_basic_block(BasicBlock *BB, DepGraph &DG) {
-//DependenceGraph::DepGraph_descriptor DependenceGraph::get_vertex_descriptor_for_basic_block(BasicBlock *BB) {
-	DepGraph_iterator vi, ve;
-	for (boost::tie(vi, ve) = vertices(DG); vi != ve; vi++) {
-		if (DG[*vi] == BB) {
-			return *vi;
+// Function: count_removed_memory_dependences
+// Counts the basic blocks with memory instructions that BB, once its dependency
+// list is complete, does not depend on although it has memory instructions
+void DependenceGraph::count_removed_memory_dependences(BasicBlock *BB) {
+	if (!MemoryVertices.test(get_vertex_descriptor_for_basic_block(BB, *DG))) {
+		return;
+	}
+	BitVector memoryDeps(currDeps);
+	memoryDeps &= MemoryVertices;
+	currStats->removed += MemoryBBs.size() - memoryDeps.count();
+}
+
+
+// Function: add_memory_dependences
+// Adds the basic blocks of the memory instructions that the load or store I
+// depends on to the dependency list, as given by DependenceAnalysis. Each other
+// load or store J is tested as the source of a dependence to I (unless both
+// read memory). Levels of the direction vector are examined from the outermost
+// common loop, the first level that is not = carries the dependence:
+//	- < with a constant distance d, I depends on J d iterations earlier
+//	- >, the dependence goes from I to J and is found when J is examined
+//	- anything else, I depends on the most recent execution of J
+// and so does a confused dependence, which has no direction vector.
+// A dependence that is not carried by any loop is between the executions of
+// the same iteration, so it needs no edge within a basic block. Basic blocks
+// with other memory instructions are always dependences.
+void DependenceGraph::add_memory_dependences(Instruction *I, std::vector<BasicBlock *> &list) {
+	BasicBlock *currBB = I->getParent();
+	for (auto BB = OtherMemoryBBs.begin(); BB != OtherMemoryBBs.end(); BB++) {
+		insert_dependent_basic_block(list, *BB, NULL, DEP_UNKNOWN);
+	}
+
+	for (auto it = MemoryInsts.begin(); it != MemoryInsts.end(); it++) {
+		Instruction *J = *it;
+		if (isa<LoadInst>(I) && isa<LoadInst>(J)) {
+			continue;
+		}
+		BasicBlock *depBB = J->getParent();
+		std::unique_ptr<Dependence> D = DA->depends(J, I, true);
+		if (!D) {
+			continue;
+		}
+		if (D->isConfused()) {
+			*outputLog << "Unknown dependence on: ";
+			J->print(*outputLog);
+			*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
+			insert_dependent_basic_block(list, depBB, J, get_memory_dependence_kind(J, I));
+			continue;
+		}
+
+		unsigned level = 1;
+		while (level <= D->getLevels() && D->getDirection(level) == Dependence::DVEntry::EQ) {
+			level++;
+		}
+
+		if (level > D->getLevels()) {
+			// not carried, within a basic block this is the same execution
+			if (depBB == currBB) {
+				continue;
+			}
+			*outputLog << "Loop independent dependence on: ";
+			J->print(*outputLog);
+			*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
+			insert_dependent_basic_block(list, depBB, J, get_memory_dependence_kind(J, I));
+			continue;
 		}
+
+		unsigned direction = D->getDirection(level);
+		if (!(direction & Dependence::DVEntry::LT)) {
+			continue;
+		}
+		const SCEVConstant *distance = dyn_cast_or_null<SCEVConstant>(D->getDistance(level));
+		if (direction != Dependence::DVEntry::LT || !distance || distance->getValue()->getSExtValue() <= 0) {
+			*outputLog << "Loop carried dependence with unknown distance on: ";
+			J->print(*outputLog);
+			*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
+			insert_dependent_basic_block(list, depBB, J, get_memory_dependence_kind(J, I));
+			continue;
+		}
+
+		// the loop at the carrying level, the common loops of I and J are
+		// numbered from the outermost
+		Loop *carrier = LI->getLoopFor(currBB);
+		while (carrier && !carrier->contains(depBB)) {
+			carrier = carrier->getParentLoop();
+		}
+		while (carrier && carrier->getLoopDepth() > level) {
+			carrier = carrier->getParentLoop();
+		}
+		if (!carrier) {
+			insert_dependent_basic_block(list, depBB, J, get_memory_dependence_kind(J, I));
+			continue;
+		}
+		*outputLog << "Loop carried dependence at distance " << distance->getValue()->getSExtValue()
+			<< " of loop " << carrier->getHeader()->getName() << " on: ";
+		J->print(*outputLog);
+		*outputLog << "\tfrom basic block: " << depBB->getName() << "\n";
+		insert_carried_dependent_basic_block(list, depBB, carrier->getHeader(), distance->getValue()->getZExtValue(), J, get_memory_dependence_kind(J, I));
+	}
+}
+
+
+// Function: add_dependence_edge
+// Adds the edge v -> dep to the graph and to the dependence matrix
+void DependenceGraph::add_dependence_edge(DepGraph_descriptor v, DepGraph_descriptor dep, const DepGraphEdge &edge) {
+	DepGraphIndex &index = (*DG)[boost::graph_bundle];
+	boost::add_edge(v, dep, edge, *DG);
+	index.dependent.set(v * index.numVertices + dep);
+	if (edge.carrier) {
+		index.loopCarried = true;
 	}
-	*outputLog << "Error: Could not find basic block in graph.\n";
-	assert(0);
 }
 
-void DependenceGraph::insert_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB) {
-	if (std::find(list.begin(), list.end(), BB) == list.end()) {
+
+DepGraph_descriptor DependenceGraph::get_vertex_descriptor_for_basic_block(BasicBlock *BB, DepGraph &DG) {
+	DepGraphIndex &index = DG[boost::graph_bundle];
+	auto search = index.vertex.find(BB);
+	if (search == index.vertex.end()) {
+		*outputLog << "Error: Could not find basic block in graph.\n";
+		assert(0);
+	}
+	return search->second;
+}
+
+// Function: insert_dependent_basic_block
+// adds BB to the dependency list of the basic block being processed unless it
+// is already in the list, the instruction being processed depends on producer
+// in BB (any instruction if NULL) with the given kind of dependence
+void DependenceGraph::insert_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB, Instruction *producer, DepKind kind) {
+	DepGraph_descriptor v = get_vertex_descriptor_for_basic_block(BB, *DG);
+	bool memory = (kind != DEP_SSA);
+	if (!currDeps.test(v)) {
+		currDeps.set(v);
 		list.push_back(BB);
+		currEdges[v].memory = memory;
+		currEdges[v].causes.clear();
+	} else if (!memory) {
+		currEdges[v].memory = false;
 	}
+	currEdges[v].carrier = NULL;
+	currEdges[v].distance = 0;
+	add_dependence_cause(v, producer, kind);
+}
+
+// Function: insert_carried_dependent_basic_block
+// adds BB to the dependency list with a dependence carried by the loop headed by
+// carrier at the given distance. Several carried dependences on the same basic
+// block keep the shortest distance, a dependence on the most recent execution
+// or carried by another loop makes it a dependence on the most recent execution
+void DependenceGraph::insert_carried_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB, BasicBlock *carrier, unsigned distance, Instruction *producer, DepKind kind) {
+	DepGraph_descriptor v = get_vertex_descriptor_for_basic_block(BB, *DG);
+	if (!currDeps.test(v)) {
+		currDeps.set(v);
+		list.push_back(BB);
+		currEdges[v].carrier = carrier;
+		currEdges[v].distance = distance;
+		currEdges[v].memory = true;
+		currEdges[v].causes.clear();
+	} else if (currEdges[v].carrier == carrier) {
+		currEdges[v].distance = std::min(currEdges[v].distance, distance);
+	} else {
+		currEdges[v].carrier = NULL;
+		currEdges[v].distance = 0;
+	}
+	add_dependence_cause(v, producer, kind);
+}
+
+// Function: add_dependence_cause
+// adds the dependence of the instruction being processed on producer to the
+// causes of the edge to vertex v, unless it is already there. A dependence on
+// the whole basic block (NULL producer) replaces the other causes, so an edge
+// keeps a single one of them however many instructions depend on all memory.
+void DependenceGraph::add_dependence_cause(DepGraph_descriptor v, Instruction *producer, DepKind kind) {
+	std::vector<DepGraphCause> &causes = currEdges[v].causes;
+	if (!causes.empty() && !causes.front().producer) {
+		return;
+	}
+	if (!producer) {
+		causes.clear();
+	} else if (!currCauses.insert(std::make_pair((unsigned) v, std::make_pair(producer, (unsigned) kind))).second) {
+		return;
+	}
+	DepGraphCause cause = {producer, currInst, kind};
+	causes.push_back(cause);
+}
+
+// Function: get_memory_dependence_kind
+// Return: the kind of the dependence of consumer on producer through memory
+DepKind DependenceGraph::get_memory_dependence_kind(Instruction *producer, Instruction *consumer) {
+	if (isa<CallInst>(producer) || isa<InvokeInst>(producer) || isa<CallInst>(consumer) || isa<InvokeInst>(consumer)) {
+		return DEP_UNKNOWN;
+	}
+	if (consumer->mayWriteToMemory()) {
+		return producer->mayWriteToMemory() ? DEP_WAW : DEP_WAR;
+	}
+	if (producer->mayReadFromMemory() && !producer->mayWriteToMemory()) {
+		return DEP_RAR;
+	}
+	// stores, and allocations that define the location
+	return DEP_RAW;
 }
 
 void DependenceGraph::insert_dependent_basic_block_all(std::vector<BasicBlock *> &list) {
 	for (auto BB = func->begin(); BB != func->end(); BB++) {
-		insert_dependent_basic_block(list, BB);
+		insert_dependent_basic_block(list, BB, NULL, DEP_UNKNOWN);
 	}
 }
 
 // Function insert_dependent_basic_block_all_memory
 // adds all basic blocks with memory instructions into dependency list
 void DependenceGraph::insert_dependent_basic_block_all_memory(std::vector<BasicBlock *> &list) {
+	currStats->unknown++;
 	for (auto BB = MemoryBBs.begin(); BB != MemoryBBs.end(); BB++) {
-		insert_dependent_basic_block(list, *BB);
+		insert_dependent_basic_block(list, *BB, NULL, DEP_UNKNOWN);
 	}
 }
 
@@ -265,14 +941,8 @@ bool DependenceGraph::is_basic_block_dependent(BasicBlock *BB1, BasicBlock *BB2,
 	DepGraph_descriptor bb1 = get_vertex_descriptor_for_basic_block(BB1, DG);
 	DepGraph_descriptor bb2 = get_vertex_descriptor_for_basic_block(BB2, DG);
 
-	// unfortunately I need to iterate through all the out edges of bb1
-	DepGraph_out_edge_iterator oi, oe;
-	for (boost::tie(oi, oe) = boost::out_edges(bb1, DG); oi != oe; oi++) {
-		if (bb2 == boost::target(*oi, DG)) {
-			return true;
-		}
-	}
-	return false;
+	DepGraphIndex &index = DG[boost::graph_bundle];
+	return index.dependent.test(bb1 * index.numVertices + bb2);
 }
 
 
@@ -290,6 +960,18 @@ void DependenceGraph::get_all_basic_block_dependencies(DepGraph &DG, BasicBlock
 	}
 }
 
+// Function: get_all_basic_block_dependencies
+// same as above, with the property of each dependence edge, which stays valid
+// as long as the graph is not modified
+void DependenceGraph::get_all_basic_block_dependencies(DepGraph &DG, BasicBlock *BB, std::vector<std::pair<BasicBlock *, const DepGraphEdge *> > &deps) {
+	DepGraph_descriptor v = get_vertex_descriptor_for_basic_block(BB, DG);
+	DepGraph_out_edge_iterator oi, oe;
+	for (boost::tie(oi, oe) = boost::out_edges(v, DG); oi != oe; oi++) {
+		DepGraph_descriptor dep = boost::target(*oi, DG);
+		deps.push_back(std::make_pair(DG[dep], &DG[*oi]));
+	}
+}
+
 char DependenceGraph::ID = 0;
 static RegisterPass<DependenceGraph> X("depgraph", "FPGA-Advisor dependence graph generator", false, false);
 
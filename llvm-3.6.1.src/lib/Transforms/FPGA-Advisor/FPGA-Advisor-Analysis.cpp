@@ -47,17 +47,22 @@
 // FIXME Need to change the direction of the trace graph.... sighh
 
 #include "fpga_common.h"
+#include "FPGA-Advisor-Trace.h"
 
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
 #include <fstream>
-#include <fstream>
-#include <regex>
+#include <thread>
 #include <time.h>
 
 #define DEBUG_TYPE "fpga-advisor-analysis"
 
 using namespace llvm;
 using namespace fpga;
-using std::ifstream;
 
 //===----------------------------------------------------------------------===//
 // Some globals ... is that bad? :/
@@ -73,7 +78,6 @@ DepGraph *depGraph;
 std::map<BasicBlock *, int> *LT;
 // area table
 std::map<BasicBlock *, int> *AT;
-int cpuCycle;
 
 //===----------------------------------------------------------------------===//
 // Advisor Analysis Pass options
@@ -87,6 +91,22 @@ static cl::opt<bool> HideGraph("hide-graph", cl::desc("If enabled, disables prin
 		cl::Hidden, cl::init(false));
 static cl::opt<bool> NoMessage("no-message", cl::desc("If enabled, disables printing of messages for debug"),
 		cl::Hidden, cl::init(false));
+cl::opt<std::string> fpga::LatencyTableFile("latency-table", cl::desc("Name of the file with the latency of each operation"),
+		cl::Hidden, cl::init(""));
+static cl::opt<unsigned> AdvisorThreads("fpga-advisor-threads", cl::desc("Number of threads used to parse the trace and evaluate gradient descent candidates (0 uses all hardware threads)"),
+		cl::Hidden, cl::init(1));
+static cl::opt<std::string> IndexTraceFileName("index-trace", cl::desc("Convert the trace into an indexed trace with the given name and analyze the indexed trace"),
+		cl::Hidden, cl::init(""));
+static cl::opt<unsigned> LoopFoldIterations("loop-fold-iterations", cl::desc("Fold runs of identical loop iterations in the trace, keeping this many iterations (at least 3) and extrapolating the others from their initiation interval, 0 disables folding"),
+		cl::Hidden, cl::init(0));
+static cl::opt<bool> StreamTrace("stream-trace", cl::desc("Analyze each call as soon as it returns instead of reading the whole trace into memory"),
+		cl::Hidden, cl::init(false));
+static cl::opt<unsigned> StreamTraceCache("stream-trace-cache", cl::desc("Number of trace graph vertices of the calls to each function that are kept in memory between the passes over a streamed trace"),
+		cl::Hidden, cl::init(1 << 20));
+static cl::opt<bool> InstructionDependences("instruction-dependences", cl::desc("Start a basic block as soon as the instructions it depends on have finished instead of the whole basic blocks they belong to"),
+		cl::Hidden, cl::init(false));
+static cl::opt<bool> VerifyReschedule("verify-reschedule", cl::desc("Check the latency of each gradient descent candidate against a full schedule of the calls"),
+		cl::Hidden, cl::init(false));
 
 //===----------------------------------------------------------------------===//
 // List of statistics -- not necessarily the statistics listed above,
@@ -105,6 +125,59 @@ STATISTIC(ConvergenceCounter, "Number of steps taken to converge in gradient des
 //===----------------------------------------------------------------------===//
 // Helper functions
 //===----------------------------------------------------------------------===//
+
+// size in bytes of the pieces of the trace file that are parsed concurrently
+static const size_t TraceChunkSize = 4 << 20;
+
+// Function: get_thread_count
+// Return: the number of threads given by -fpga-advisor-threads
+static unsigned get_thread_count() {
+	unsigned numThreads = AdvisorThreads;
+	if (numThreads == 0) {
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	return numThreads;
+}
+
+// Function: get_ready_offset
+// Return: the cycle after the start of the basic block with index depIndex at
+// which the instructions that cause the dependence edge have finished, the
+// latency of the basic block if any of them is not known
+static int get_ready_offset(FunctionInfo *FI, const DepGraphEdge &edge, unsigned depIndex) {
+	if (edge.causes.empty()) {
+		return FI->latency[depIndex];
+	}
+	int offset = 0;
+	for (auto it = edge.causes.begin(); it != edge.causes.end(); it++) {
+		if (!it->producer) {
+			return FI->latency[depIndex];
+		}
+		offset = std::max(offset, FI->finishTable.lookup(it->producer));
+	}
+	return offset;
+}
+
+// Function: remove_duplicate_dependences
+// Removes the repeated vertices of deps, keeping the largest of their offsets
+// (offsets[i] goes with deps[i]). The remaining dependences are left sorted in
+// reverse order.
+static void remove_duplicate_dependences(std::vector<TraceGraph_vertex_descriptor> &deps, std::vector<int> &offsets) {
+	std::vector<std::pair<TraceGraph_vertex_descriptor, int> > pairs;
+	for (unsigned i = 0; i < deps.size(); i++) {
+		pairs.push_back(std::make_pair(deps[i], offsets[i]));
+	}
+	std::sort(pairs.begin(), pairs.end(), std::greater<std::pair<TraceGraph_vertex_descriptor, int> >());
+	deps.clear();
+	offsets.clear();
+	for (auto it = pairs.begin(); it != pairs.end(); it++) {
+		// the largest offset of each vertex comes first
+		if (deps.empty() || deps.back() != it->first) {
+			deps.push_back(it->first);
+			offsets.push_back(it->second);
+		}
+	}
+}
+
 //template <typename T> void output_dot_graph(std::ostream stream, T const &g) {
 //	boost::write_graphviz(stream, g);
 //}
@@ -149,9 +222,33 @@ bool AdvisorAnalysis::runOnModule(Module &M) {
 	//=------------------------------------------------------=//
 	// [3] Read trace from file into memory
 	//=------------------------------------------------------=//
-	if (! get_program_trace(TraceFileName)) {
-		errs() << "Could not find trace file: " << TraceFileName << "!\n";
+	traceFileName = TraceFileName;
+	if (! IndexTraceFileName.empty()) {
+		if (! convert_program_trace(TraceFileName, IndexTraceFileName)) {
+			errs() << "Could not convert trace file: " << TraceFileName << "!\n";
+			return false;
+		}
+		traceFileName = IndexTraceFileName;
+	}
+
+	// a streamed trace is read once per analysis step of each function
+	// instead, see stream_program_trace
+	if (StreamTrace) {
+		if (! sys::fs::exists(traceFileName)) {
+			errs() << "Could not find trace file: " << traceFileName << "!\n";
+			return false;
+		}
+	} else if (! get_program_trace(traceFileName)) {
+		errs() << "Could not find trace file: " << traceFileName << "!\n";
 		return false;
+	} else {
+		// calls that never returned are kept as they are
+		traceCallStack.clear();
+		for (auto it = executionGraph.begin(); it != executionGraph.end(); it++) {
+			for (auto graph = it->second.begin(); graph != it->second.end(); graph++) {
+				finish_loop_tracking(*graph);
+			}
+		}
 	}
 
 	// should also contain a sanity check to follow the trace and make sure
@@ -164,8 +261,14 @@ bool AdvisorAnalysis::runOnModule(Module &M) {
 	//=------------------------------------------------------=//
 	// [4] Analysis after dynamic feedback for each function
 	//=------------------------------------------------------=//
-	for (auto F = M.begin(), FE = M.end(); F != FE; F++) {
-		run_on_function(F);
+	// callees are analyzed before their callers, so that the vertices that
+	// make calls inherit the latency of the calls
+	for (scc_iterator<CallGraph *> SCC = scc_begin(callGraph); ! SCC.isAtEnd(); ++SCC) {
+		for (auto N = SCC->begin(), NE = SCC->end(); N != NE; N++) {
+			if (Function *F = (*N)->getFunction()) {
+				run_on_function(F);
+			}
+		}
 	}
 
 	//=------------------------------------------------------=//
@@ -193,29 +296,56 @@ void AdvisorAnalysis::visitFunction(Function &F) {
 	newFuncInfo->bbList.clear();
 	newFuncInfo->instList.clear();
 	newFuncInfo->loopList.clear();
+	newFuncInfo->callLatency = 0;
 	
 	if (! F.isDeclaration()) {
 		// only get the loop info for functions with a body, else will get assertion error
-		newFuncInfo->loopInfo = &getAnalysis<LoopInfo>(F);
+		newFuncInfo->loopInfo = &run_function_analyses(F, newFuncInfo);
 		*outputLog << "PRINTOUT THE LOOPINFO\n";
 		newFuncInfo->loopInfo->print(*outputLog);
 		*outputLog << "\n";
-		// find all the loops in this function
+		// basic blocks are not visited yet, number them the same way
+		// visitBasicBlock does
+		DenseMap<BasicBlock *, unsigned> blockIndex;
+		unsigned numBlocks = 0;
+		for (auto BB = F.begin(), BE = F.end(); BB != BE; BB++) {
+			blockIndex[BB] = numBlocks++;
+		}
+		newFuncInfo->headerLoop.assign(numBlocks, -1);
+
+		// find all the loops in this function, each loop is listed before
+		// the loops nested in it
+		std::vector<std::pair<Loop *, int> > worklist;
 		for (LoopInfo::reverse_iterator li = newFuncInfo->loopInfo->rbegin(), le = newFuncInfo->loopInfo->rend(); li != le; li++) {
+			worklist.push_back(std::make_pair(*li, -1));
+		}
+		for (unsigned i = 0; i < worklist.size(); i++) {
+			Loop *L = worklist[i].first;
 			*outputLog << "Encountered a loop!\n";
-			(*li)->print(*outputLog);
-			*outputLog << "\n" << (*li)->isAnnotatedParallel() << "\n";
+			L->print(*outputLog);
+			*outputLog << "\n" << L->isAnnotatedParallel() << "\n";
 			// append to the loopList
-			//newFuncInfo->loopList.push_back(*li);
 			LoopIterInfo newLoop;
-			//newLoop.loopInfo = *li;
 			// how many subloops are contained within the loop
-			*outputLog << "This natural loop contains " << (*li)->getSubLoops().size() << " subloops\n";
-			newLoop.subloops = (*li)->getSubLoopsVector();
+			*outputLog << "This natural loop contains " << L->getSubLoops().size() << " subloops\n";
+			newLoop.subloops = L->getSubLoopsVector();
 			*outputLog << "Copied subloops " << newLoop.subloops.size() << "\n";
+			newLoop.header = blockIndex[L->getHeader()];
+			newLoop.parent = worklist[i].second;
+			newLoop.blocks.resize(numBlocks);
+			for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++) {
+				newLoop.blocks.set(blockIndex[*BB]);
+			}
+			newLoop.invocations = 0;
+			newLoop.minIter = 0;
+			newLoop.totalIter = 0;
 			newLoop.maxIter = 0;
 			newLoop.parIter = 0;
+			newFuncInfo->headerLoop[newLoop.header] = newFuncInfo->loopList.size();
 			newFuncInfo->loopList.push_back(newLoop);
+			for (auto sub = newLoop.subloops.begin(), se = newLoop.subloops.end(); sub != se; sub++) {
+				worklist.push_back(std::make_pair(*sub, (int) i));
+			}
 		}
 	}
 
@@ -223,6 +353,37 @@ void AdvisorAnalysis::visitFunction(Function &F) {
 	functionMap.insert( {&F, newFuncInfo} );
 }
 
+// Function: get_function_analysis
+// Return: the instance of the function pass T that the pass manager ran along
+// with P, which must be one of the function passes required by this pass.
+// Unlike getAnalysis<T>(F), the function passes are not run again.
+template <typename T> static T &get_function_analysis(Pass &P) {
+	Pass *result = P.getResolver()->getAnalysisIfAvailable(&T::ID, true);
+	assert(result && "Function pass did not run with the other required passes!");
+	return *(T *) result->getAdjustedAnalysisPointer(&T::ID);
+}
+
+// Function: run_function_analyses
+// Return: the loop info of F, valid until the analyses run on another function
+// Runs the function passes this pass requires on F and moves their results
+// into FI. Requesting the result of any of them makes the pass manager run all
+// of them on F (including MemoryDependenceAnalysis), so only the loop info is
+// requested and the other passes are looked up in the pass manager that has
+// just run them.
+LoopInfo &AdvisorAnalysis::run_function_analyses(Function &F, FunctionInfo *FI) {
+	LoopInfo &loops = getAnalysis<LoopInfo>(F);
+	DependenceGraph &dependencePass = get_function_analysis<DependenceGraph>(loops);
+	FunctionScheduler &schedulerPass = get_function_analysis<FunctionScheduler>(loops);
+	FunctionAreaEstimator &areaPass = get_function_analysis<FunctionAreaEstimator>(loops);
+
+	// the passes start from empty results on the next function
+	FI->dependenceGraph = dependencePass.takeDepGraph();
+	FI->latencyTable = std::move(schedulerPass.latencyTable);
+	FI->finishTable = std::move(schedulerPass.finishTable);
+	FI->areaTable = std::move(areaPass.getAreaTable());
+	return loops;
+}
+
 void AdvisorAnalysis::visitBasicBlock(BasicBlock &BB) {
 	//*outputLog << "visit BasicBlock: " << BB.getName() << "\n";
 	BasicBlockCounter++;
@@ -230,6 +391,7 @@ void AdvisorAnalysis::visitBasicBlock(BasicBlock &BB) {
 	// make sure function is in functionMap
 	assert(functionMap.find(BB.getParent()) != functionMap.end());
 	FunctionInfo *FI = functionMap.find(BB.getParent())->second;
+	FI->bbIndex[&BB] = FI->bbList.size();
 	FI->bbList.push_back(&BB);
 }
 
@@ -258,85 +420,70 @@ void AdvisorAnalysis::print_statistics() {
 		errs() << "\t" << "Number of BasicBlocks : " << it->second->bbList.size() << "\n";
 		errs() << "\t" << "Number of Instructions : " << it->second->instList.size() << "\n";
 		errs() << "\t" << "Number of Loops : " << it->second->loopList.size() << "\n";
+		std::vector<LoopIterInfo> &loops = it->second->loopList;
+		for (auto loop = loops.begin(); loop != loops.end(); loop++) {
+			errs() << "\t\t" << "Loop " << it->second->bbList[loop->header]->getName() << " : ";
+			if (loop->invocations == 0) {
+				errs() << "not executed\n";
+				continue;
+			}
+			errs() << "trip count min " << loop->minIter << " avg " << loop->totalIter / loop->invocations
+				<< " max " << loop->maxIter << ", parallel iterations " << loop->parIter << "\n";
+		}
 	}
 }
 
 
 // Function: find_recursive_functions
 // Return: nothing
+// Computes the CallGraphInfo of every function in a single bottom-up walk of
+// the strongly connected components of the call graph, the callees outside of
+// a component have been visited before the component. The functions of a
+// component share their properties. Also fills recursiveFunctionList.
 void AdvisorAnalysis::find_recursive_functions(Module &M) {
 	*outputLog << __func__ << "\n";
-	// look at call graph for loops
-	//CallGraph &CG = getAnalysis<CallGraphWrapperPass>().getCallGraph();
-	//DEBUG(CG.print(dbgs()); dbgs() << "\n");
 	DEBUG(callGraph->print(dbgs()); dbgs() << "\n");
-	//CallGraph &CG = CallGraphAnalysis::run(&M);
-
-	// do a depth first search to find the recursive functions
-	// a function is recursive if any of its called functions is
-	// either itself or contains a call to itself
-	// (ironically), use recursion for this...
-	// store onto the recursiveFunctionList
-	for (auto F = M.begin(), FE = M.end(); F != FE; F++) {
-		if (!F->isDeclaration()) {
-			*outputLog << "Calling does_function_recurse on function: " << F->getName() << "\n";
-			std::vector<Function *> fStack;
-			// function will modify recursiveFunctionList directly
-			does_function_recurse(F, callGraph->getOrInsertFunction(F), fStack); 
-			assert(fStack.empty());
-		} else {
-			errs() << __func__ << " ignored.\n";
-		}
-	}
-	DEBUG(print_recursive_functions());
-}
 
-// Function: does_function_recurse
-// Return: nothing
-// Modifies recursiveFunctionList vector
-void AdvisorAnalysis::does_function_recurse(Function *func, CallGraphNode *CGN, std::vector<Function *> &stack) {
-	*outputLog << "does_function_recurse: " << CGN->getFunction()->getName() << "\n";
-	*outputLog << "stack size: " << stack.size() << "\n";
-	// if this function exists within the stack, function recurses and add to list
-	if ((stack.size() > 0) && (std::find(stack.begin(), stack.end(), CGN->getFunction()) != stack.end())) {
-		*outputLog << "Function recurses: " << CGN->getFunction()->getName() << "\n";
-		
-		// delete functions off "stack"
-		//while (stack[stack.size()-1] != CGN->getFunction()) {
-			// pop off stack
-		//	stack.pop_back();
-		//	*outputLog << "stack size: " << stack.size() << "\n";
-		//}
-		//stack.pop_back();
-		//*outputLog << "stack size: " << stack.size() << "\n";
-		// add to recursiveFunctionList only if this is the function we are checking to be recursive or not
-		// this avoids the situation where a recursive function is added to the list multiple times
-		if (CGN->getFunction() == func) {
-			recursiveFunctionList.push_back(CGN->getFunction());
+	for (scc_iterator<CallGraph *> SCC = scc_begin(callGraph); ! SCC.isAtEnd(); ++SCC) {
+		CallGraphInfo info;
+		info.recursive = SCC.hasLoop();
+		info.reachesRecursive = info.recursive;
+		info.reachesExternal = false;
+
+		for (auto N = SCC->begin(), NE = SCC->end(); N != NE; N++) {
+			Function *F = (*N)->getFunction();
+			if (F && F->isDeclaration()) {
+				info.reachesExternal = true;
+			}
+			for (auto it = (*N)->begin(), et = (*N)->end(); it != et; it++) {
+				Function *callee = it->second->getFunction();
+				if (! callee) {
+					// call through a function pointer or from a declaration
+					info.reachesExternal = true;
+					continue;
+				}
+				// callees within the component are not visited yet
+				auto search = callGraphInfo.find(callee);
+				if (search != callGraphInfo.end()) {
+					info.reachesRecursive |= search->second.reachesRecursive;
+					info.reachesExternal |= search->second.reachesExternal;
+				}
+			}
 		}
-		return;
-	}
 
-	// else, add the function to the stack and call does_function_recurse on each of the functions
-	// contained by this CGN
-	stack.push_back(CGN->getFunction());
-	for (auto it = CGN->begin(), et = CGN->end(); it != et; it++) {
-		CallGraphNode *calledGraphNode = it->second;
-		*outputLog << "Found a call to function: " << calledGraphNode->getFunction()->getName() << "\n";
-		//stack.push_back(calledGraphNode->getFunction());
-		// ignore this function if its primary definition is outside current module
-		if (! calledGraphNode->getFunction()->isDeclaration()) {
-			does_function_recurse(func, calledGraphNode, stack);
-		} else { // print a warning
-			errs() << __func__ << " is being ignored, it is declared outside of this translational unit.\n";
+		for (auto N = SCC->begin(), NE = SCC->end(); N != NE; N++) {
+			Function *F = (*N)->getFunction();
+			if (! F) {
+				continue;
+			}
+			callGraphInfo[F] = info;
+			if (info.recursive && ! F->isDeclaration()) {
+				*outputLog << "Function recurses: " << F->getName() << "\n";
+				recursiveFunctionList.push_back(F);
+			}
 		}
-		*outputLog << "Returned from call to function: " 
-					<< calledGraphNode->getFunction()->getName() << "\n";
 	}
-	// pop off the stack
-	stack.pop_back();
-	*outputLog << "stack size: " << stack.size() << "\n";
-	return;
+	DEBUG(print_recursive_functions());
 }
 
 
@@ -359,11 +506,22 @@ bool AdvisorAnalysis::run_on_function(Function *F) {
 		return false;
 	}
 
-	LT = &getAnalysis<FunctionScheduler>(*F).getLatencyTable();
-	AT = &getAnalysis<FunctionAreaEstimator>(*F).getAreaTable();
+	// the analyses were run when the function was visited
+	FunctionInfo *FI = functionMap[F];
+	LT = &FI->latencyTable;
+	AT = &FI->areaTable;
+	depGraph = FI->dependenceGraph.get();
 
-	// get the dependence graph for the function
-	depGraph = &getAnalysis<DependenceGraph>(*F).getDepGraph();
+	// latency of each basic block by basic block index for the schedulers
+	FI->latency.clear();
+	for (auto BB = FI->bbList.begin(); BB != FI->bbList.end(); BB++) {
+		FI->latency.push_back(FunctionScheduler::get_basic_block_latency(*LT, *BB));
+	}
+
+	// the streamed calls are updated as they are read
+	for (auto graph = executionGraph[F].begin(); graph != executionGraph[F].end(); graph++) {
+		update_callee_latencies(*graph);
+	}
 
 	// for each execution of the function found in the trace
 	// we want to find the optimal tiling for the basicblocks
@@ -396,10 +554,21 @@ bool AdvisorAnalysis::run_on_function(Function *F) {
 	print_basic_block_configuration(F);
 	*outputLog << "===-------------------------------------===";
 
-	if (!HideGraph) {
+	// the streamed trace has already printed the graph of each call in the
+	// final configuration, unless all calls were kept in memory
+	if (!HideGraph && (!StreamTrace || streamSummary.complete)) {
 		print_optimal_configuration_for_all_calls(F);
 	}
 
+	// the replication factors are only written to the IR once the
+	// configuration is final
+	annotate_basic_block_instance_count(F);
+
+	// the calls kept by the streamed trace are not needed anymore
+	if (StreamTrace) {
+		start_streamed_function(F);
+	}
+
 	return true;
 }
 
@@ -429,56 +598,19 @@ bool AdvisorAnalysis::has_unsynthesizable_construct(Function *F) {
 }
 
 // Function: is_recursive_function
-// Return: true if function is contained in recursiveFunctionList
-// A function recurses if it or any of the functions it calls calls itself
+// Return: true if function is part of a cycle in the call graph
 // TODO?? I do not handle function pointers by the way
 bool AdvisorAnalysis::is_recursive_function(Function *F) {
-	return (std::find(recursiveFunctionList.begin(), recursiveFunctionList.end(), F) 
-			!= recursiveFunctionList.end());
+	auto search = callGraphInfo.find(F);
+	return search != callGraphInfo.end() && search->second.recursive;
 }
 
 // Function: has_recursive_call
 // Return: true if function is recursive or contains a call to a recursive 
-// function on the recursiveFunctionList
+// function, directly or indirectly
 bool AdvisorAnalysis::has_recursive_call(Function *F) {
-	if (is_recursive_function(F)) {
-		return true;
-	}
-
-	bool result = false;
-
-	// look through the CallGraph for this function to see if this function makes calls to 
-	// recursive functions either directly or indirectly
-	if (! F->isDeclaration()) {
-		result = does_function_call_recursive_function(callGraph->getOrInsertFunction(F));
-	} else {
-		//errs() << __func__ << " is being ignored, it is declared outside of this translational unit.\n";
-	}
-
-	return result;
-}
-
-// Function: does_function_call_recursive_function
-// Return: true if function contain a call to a function which is recursive
-// This function should not recurse infinitely since it will stop at a recursive function
-// and therefore not get stuck in a loop in the call graph
-bool AdvisorAnalysis::does_function_call_recursive_function(CallGraphNode *CGN) {
-	if (is_recursive_function(CGN->getFunction())) {
-		return true;
-	}
-
-	bool result = false;
-
-	for (auto it = CGN->begin(), et = CGN->end(); it != et; it++) {
-		CallGraphNode *calledGraphNode = it->second;
-		*outputLog << "Found a call to function: " << calledGraphNode->getFunction()->getName() << "\n";
-		if (! calledGraphNode->getFunction()->isDeclaration()) {
-			result |= does_function_call_recursive_function(calledGraphNode);
-		} else {
-			//errs() << __func__ << " is being ignored, it is declared outside of this translational unit.\n";
-		}
-	}
-	return result;
+	auto search = callGraphInfo.find(F);
+	return search != callGraphInfo.end() && search->second.reachesRecursive;
 }
 
 // Function: has_external_call
@@ -488,216 +620,961 @@ bool AdvisorAnalysis::has_external_call(Function *F) {
 	if (F->isDeclaration()) {
 		return true;
 	}
-
-	bool result = does_function_call_external_function(callGraph->getOrInsertFunction(F));
-
-	return result;
-}
-
-// Function: does_function_call_external_function
-// Return: true if function contain a call to a function which is extenal to the module
-// Always beware of recursive functions when dealing with the call graph
-bool AdvisorAnalysis::does_function_call_external_function(CallGraphNode *CGN) {
-	if (CGN->getFunction()->isDeclaration()) {
-		return true;
-	}
-
-	bool result = false;
-	
-	for (auto it = CGN->begin(), et = CGN->end(); it != et; it++) {
-		CallGraphNode *calledGraphNode = it->second;
-		*outputLog << "Found a call to function: " << calledGraphNode->getFunction()->getName() << "\n";
-		if (std::find(recursiveFunctionList.begin(), recursiveFunctionList.end(), calledGraphNode->getFunction()) 
-			== recursiveFunctionList.end()) {
-			result |= does_function_call_external_function(calledGraphNode);
-		} else {
-			//errs() << __func__ << " is being ignored, it is recursive.\n";
-		}
-	}
-	return result;
+	auto search = callGraphInfo.find(F);
+	return search != callGraphInfo.end() && search->second.reachesExternal;
 }
 
 // Function: get_program_trace
 // Return: false if unsuccessful
 // Reads input trace file, parses and stores trace into executionTrace map
+// The trace may either be the text trace printed by the default instrumentation
+// or the binary trace written by the trace runtime (-binary-trace)
 // TODO: do not add to trace the basic blocks which have only a branch instruction
 bool AdvisorAnalysis::get_program_trace(std::string fileIn) {
 	// clear the hash
 	//executionTrace.clear();
 
-	// read file
-	ifstream fin;
-	fin.open(fileIn.c_str());
-	if (!fin.good()) {
+	ErrorOr<std::unique_ptr<MemoryBuffer> > traceBuffer = MemoryBuffer::getFile(fileIn);
+	if (!traceBuffer) {
 		return false; // file not found
 	}
-	
-	std::string line;
 
-	// unique ID for each basic block executed
-	int ID = 0;
+	// resolve names and IDs through an index instead of scanning the module
+	build_name_index();
 
-	//TraceGraph::vertex_descriptor prevVertex = 0;
+	if ((*traceBuffer)->getBuffer().startswith(StringRef(FPGA_ADVISOR_TRACE_MAGIC, FPGA_ADVISOR_TRACE_MAGIC_SIZE))) {
+		return get_binary_program_trace(**traceBuffer);
+	}
+	if ((*traceBuffer)->getBuffer().startswith(StringRef(FPGA_ADVISOR_INDEXED_TRACE_MAGIC, FPGA_ADVISOR_TRACE_MAGIC_SIZE))) {
+		return get_indexed_program_trace(**traceBuffer);
+	}
+
+	// split the trace into chunks at line boundaries
+	std::vector<StringRef> pieces;
+	StringRef trace = (*traceBuffer)->getBuffer();
+	while (!trace.empty()) {
+		size_t split = trace.find('\n', std::min(TraceChunkSize, trace.size()));
+		if (split == StringRef::npos) {
+			split = trace.size();
+		} else {
+			split++;
+		}
+		pieces.push_back(trace.substr(0, split));
+		trace = trace.substr(split);
+	}
+
+	return parse_program_trace(pieces, &AdvisorAnalysis::parse_text_trace_chunk);
+}
+
+// Function: parse_text_trace_chunk
+// Return: false if unsuccessful, the error is recorded in the chunk
+// Resolves the lines of a chunk of the text trace into trace events. Only reads
+// the name index, so chunks may be parsed concurrently.
+bool AdvisorAnalysis::parse_text_trace_chunk(TraceChunk &chunk) {
+	raw_string_ostream error(chunk.error);
+	// the lines are tokenized in place, no copies of the trace are made
+	for (StringRef rest = chunk.data; !rest.empty(); ) {
+		std::pair<StringRef, StringRef> line = rest.split('\n');
+		rest = line.second;
+		StringRef lineRef = line.first;
+		if (lineRef.empty()) {
+			continue;
+		}
 
-	while (std::getline(fin, line)) {
 		// There are 3 types of messages:
 		//	1. Enter Function: <func name>
 		//	2. Basic Block: <basic block name> Function: <func name>
 		//	3. Return from: <func name>
-		if (std::regex_match(line, std::regex("(Entering Function: )(.*)"))) {
-			// enter function into execution trace, if not already present
-			const char *delimiter = " ";
-			
-			// make a non-const copy of line
-			std::vector<char> lineCopy(line.begin(), line.end());
-			lineCopy.push_back(0);
-
-			//=----------------------------=//
-			char *pch = std::strtok(&lineCopy[0], delimiter);
-			// Entering
-			pch = strtok(NULL, delimiter);
-			// Function:
-			pch = strtok(NULL, delimiter);
-			// funcName
-			std::string funcString(pch);
-			//=----------------------------=//
-
-			Function *F = find_function_by_name(funcString);
-			if (!F) {
+		// and with -trace-memory
+		//	4. Load: <address> <size> or Store: <address> <size>
+		TraceEvent event;
+		event.basicBlock = NULL;
+		if (lineRef.startswith("Load: ") || lineRef.startswith("Store: ")) {
+			// Load:<space>address<space>size
+			event.kind = lineRef.startswith("Load: ") ? FPGA_ADVISOR_TRACE_LOAD : FPGA_ADVISOR_TRACE_STORE;
+			event.function = NULL;
+			std::pair<StringRef, StringRef> tokens = lineRef.split(' ').second.split(' ');
+			if (tokens.first.getAsInteger(16, event.address) || tokens.second.getAsInteger(10, event.size)) {
+				error << "Unexpected trace input!\n" << lineRef << "\n";
+				return false;
+			}
+			// the size is kept as it is, unlike in the binary trace
+		} else if (lineRef.startswith("Entering Function: ")) {
+			// Entering<space>Function:<space>funcName
+			StringRef funcString = lineRef.substr(strlen("Entering Function: ")).split(' ').first;
+
+			event.kind = FPGA_ADVISOR_TRACE_ENTER;
+			event.function = find_function_by_name(funcString);
+			if (!event.function) {
 				// could not find the function by name
-				errs() << "Could not find the function from trace in program!\n";
+				error << "Could not find the function from trace in program!\n";
 				return false;
 			}
-			
-			//==----------------------------------------------------------------==//
-			ExecGraph_iterator fGraph = executionGraph.find(F);
-			ExecutionOrderListMap_iterator fOrder = executionOrderListMap.find(F);
-			if (fGraph == executionGraph.end() && fOrder == executionOrderListMap.end()) {
-				TraceGraphList emptyList;
-				executionGraph.insert(std::make_pair(F, emptyList));
-				TraceGraph newGraph;
-				executionGraph[F].push_back(newGraph);
-
-				ExecutionOrderList emptyOrderList;
-				executionOrderListMap.insert(std::make_pair(F, emptyOrderList));
-				ExecutionOrder newOrder;
-				newOrder.clear();
-				executionOrderListMap[F].push_back(newOrder);
-			} else if (fGraph != executionGraph.end() && fOrder != executionOrderListMap.end()) {
-				// function exists
-				TraceGraph newGraph;
-				fGraph->second.push_back(newGraph);
-
-				ExecutionOrder newOrder;
-				newOrder.clear();
-				fOrder->second.push_back(newOrder);
-			} else {
-				assert(0);
-			}
-			//==----------------------------------------------------------------==//
-		} else if (std::regex_match(line, std::regex("(BasicBlock: )(.*)( Function: )(.*)"))) {
-			// record this information
-			const char *delimiter = " ";
-
-			// make a non-const copy of line
-			std::vector<char> lineCopy(line.begin(), line.end());
-			lineCopy.push_back(0);
-
-			//=----------------------------=//
-			// BasicBlock:<space>bbName<space>Function:<space>funcName\n
-			// separate out string by tokens
-			char *pch = std::strtok(&lineCopy[0], delimiter);
-			// BasicBlock:
-			pch = strtok(NULL, delimiter);
-			// bbName
-			std::string bbString(pch);
-
-			pch = strtok(NULL, delimiter);
-			// Function:
-			pch = strtok(NULL, delimiter);
-			// funcName
-			std::string funcString(pch);
-			//=----------------------------=//
-
-			BasicBlock *BB = find_basicblock_by_name(funcString, bbString);
-			if (!BB) {
+		} else if (lineRef.startswith("BasicBlock: ") && lineRef.find(" Function: ") != StringRef::npos) {
+			// BasicBlock:<space>bbName<space>Function:<space>funcName
+			std::pair<StringRef, StringRef> tokens = lineRef.substr(strlen("BasicBlock: ")).split(' ');
+			StringRef bbString = tokens.first;
+			StringRef funcString = tokens.second;
+			if (!funcString.startswith("Function: ")) {
+				error << "Unexpected trace input!\n" << lineRef << "\n";
+				return false;
+			}
+			funcString = funcString.substr(strlen("Function: ")).split(' ').first;
+
+			event.kind = FPGA_ADVISOR_TRACE_BASICBLOCK;
+			event.basicBlock = find_basicblock_by_name(funcString, bbString);
+			if (!event.basicBlock) {
 				// could not find the basicblock by name
-				errs() << "Could not find the basicblock from trace in program!\n";
+				error << "Could not find the basicblock from trace in program!\n";
 				return false;
 			}
+			event.function = event.basicBlock->getParent();
+		} else if (lineRef.startswith("Return from: ")) {
+			// Return<space>from:<space>funcName
+			StringRef funcString = lineRef.substr(strlen("Return from: ")).split(' ').first;
+
+			event.kind = FPGA_ADVISOR_TRACE_RETURN;
+			event.function = find_function_by_name(funcString);
+			if (!event.function) {
+				// could not find the function by name
+				error << "Could not find the function from trace in program!\n";
+				return false;
+			}
+		} else {
+			error << "Unexpected trace input!\n" << lineRef << "\n";
+			return false;
+		}
+		chunk.events.push_back(event);
+	}
 
-			// FIXME BOOKMARK
-			if (isa<TerminatorInst>(BB->getFirstNonPHI())) {
-				// if the basic block only contains a branch/control flow and no computation
-				// then skip it, do not add to graph
-				// TODO if this is what I end up doing, need to remove looking at these
-				// basic blocks when considering transitions ?? I think that already happens.
-				continue;
+	return true;
+}
+
+// Function: get_binary_program_trace
+// Return: false if unsuccessful
+// Parses a trace written by the binary trace runtime, see FPGA-Advisor-Trace.h
+// for the format. Produces exactly the same execution graphs as the text trace.
+bool AdvisorAnalysis::get_binary_program_trace(MemoryBuffer &buffer) {
+	const char *ptr = buffer.getBufferStart();
+	const char *end = buffer.getBufferEnd();
+
+	FPGAAdvisorTraceHeader header;
+	if ((size_t) (end - ptr) < sizeof(header)) {
+		errs() << "Binary trace is missing its header!\n";
+		return false;
+	}
+	memcpy(&header, ptr, sizeof(header));
+	ptr += sizeof(header);
+	if (header.version != 1 && header.version != FPGA_ADVISOR_TRACE_VERSION) {
+		errs() << "Unsupported binary trace version " << header.version << "!\n";
+		return false;
+	}
+	// version 1 chunks only have the count of stored bytes and are never
+	// compressed
+	unsigned compression = FPGA_ADVISOR_TRACE_COMPRESSION_NONE;
+	if (header.version != 1) {
+		compression = header.compression;
+	}
+	if (compression == FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB && !zlib::isAvailable()) {
+		errs() << "Binary trace is compressed with zlib, which is not available!\n";
+		return false;
+	} else if (compression != FPGA_ADVISOR_TRACE_COMPRESSION_NONE && compression != FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB) {
+		errs() << "Unsupported binary trace compression " << compression << "!\n";
+		return false;
+	}
+
+	// split the records of each chunk written by the runtime into pieces of
+	// at most TraceChunkSize bytes, compressed chunks are decompressed by the
+	// parser and are parsed as a single piece
+	const size_t pieceSize = std::max(TraceChunkSize / sizeof(FPGAAdvisorTraceRecord), (size_t) 1) * sizeof(FPGAAdvisorTraceRecord);
+	std::vector<StringRef> pieces;
+	while (ptr < end) {
+		uint32_t chunkSize;
+		if ((size_t) (end - ptr) < sizeof(chunkSize)) {
+			errs() << "Binary trace is truncated!\n";
+			return false;
+		}
+		memcpy(&chunkSize, ptr, sizeof(chunkSize));
+		ptr += sizeof(chunkSize);
+
+		if (compression != FPGA_ADVISOR_TRACE_COMPRESSION_NONE) {
+			// the piece starts with the count of bytes of records
+			if ((size_t) (end - ptr) < sizeof(uint32_t) + chunkSize) {
+				errs() << "Binary trace is truncated!\n";
+				return false;
 			}
+			pieces.push_back(StringRef(ptr, sizeof(uint32_t) + chunkSize));
+			ptr += sizeof(uint32_t) + chunkSize;
+			continue;
+		}
 
-			// TODO We can do sanity checks here to make sure the path taken by the
-			// trace is valid
-			//executionTrace.push_back(BB);
-			//==----------------------------------------------------------------==//
-			//BBSchedElem newBB;
-			//newBB.basicblock = BB;
-			//newBB.ID = ID;
-			// mark the start and end cycles of unscheduled basic blocks as -ve
-			// mark the end cycles as 'earlier' than start cycles
-			//newBB.minCycStart = -1;
-			//newBB.minCycEnd = -2;
-			//executionTrace[BB->getParent()].back().push_back(newBB);
-			//*outputLog << funcString << "(" << executionTrace[BB->getParent()].size() << ") " << bbString << "\n";
-			//==----------------------------------------------------------------==//
-			TraceGraph::vertex_descriptor currVertex = boost::add_vertex(executionGraph[BB->getParent()].back());
-			TraceGraph &currGraph = executionGraph[BB->getParent()].back();
-			currGraph[currVertex].basicblock = BB;
-			currGraph[currVertex].ID = ID;
-			currGraph[currVertex].minCycStart = -1;
-			currGraph[currVertex].minCycEnd = -1;
-			currGraph[currVertex].name = BB->getName().str();
-			/*
-			if (currVertex != prevVertex) {
-				// A -> B means that A depends on the completion of B
-				// initial edge weight is 0, assume all performed on fpga
-				boost::add_edge(prevVertex, currVertex, 0, currGraph);
-				//boost::add_edge(currVertex, prevVertex, currGraph);
-			}
-			prevVertex = currVertex;
-			*/
-			//boost::write_graphviz(std::cerr, executionGraph[BB->getParent()].back());
-			//==----------------------------------------------------------------==//
-
-			// add to execution order
-			// check if BB exists
-			ExecutionOrder &currOrder = executionOrderListMap[BB->getParent()].back();
-			ExecutionOrder_iterator search = currOrder.find(BB);
-			if (search == currOrder.end()) {
-				// insert BB into order
-				std::vector<TraceGraph_vertex_descriptor> newVector;
-				newVector.clear();
-				newVector.push_back(currVertex);
-				currOrder.insert(std::make_pair(BB, std::make_pair(-1, newVector)));
-			} else {
-				// append to order
-				search->second.second.push_back(currVertex);
+		if (header.version != 1) {
+			// the count of bytes of records is the count of stored bytes
+			if ((size_t) (end - ptr) < sizeof(uint32_t)) {
+				errs() << "Binary trace is truncated!\n";
+				return false;
 			}
+			ptr += sizeof(uint32_t);
+		}
+		if ((size_t) (end - ptr) < chunkSize || chunkSize % sizeof(FPGAAdvisorTraceRecord) != 0) {
+			errs() << "Binary trace is truncated!\n";
+			return false;
+		}
 
-			// increment the node ID
-			ID++;
-		} else if (std::regex_match(line, std::regex("(Return from: )(.*)"))) {
-			// nothing to do really...
-		} else {
-			errs() << "Unexpected trace input!\n" << line << "\n";
+		for (StringRef records(ptr, chunkSize); !records.empty(); records = records.substr(pieceSize)) {
+			pieces.push_back(records.substr(0, pieceSize));
+		}
+		ptr += chunkSize;
+	}
+
+	if (compression == FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB) {
+		return parse_program_trace(pieces, &AdvisorAnalysis::parse_zlib_binary_trace_chunk);
+	}
+	return parse_program_trace(pieces, &AdvisorAnalysis::parse_binary_trace_chunk);
+}
+
+// Function: parse_zlib_binary_trace_chunk
+// Return: false if unsuccessful, the error is recorded in the chunk
+// Decompresses a zlib compressed chunk of the binary trace and resolves its
+// records into trace events. The chunk is the count of bytes of records
+// followed by the compressed records.
+bool AdvisorAnalysis::parse_zlib_binary_trace_chunk(TraceChunk &chunk) {
+	uint32_t recordsSize;
+	memcpy(&recordsSize, chunk.data.data(), sizeof(recordsSize));
+
+	SmallVector<char, 0> records;
+	if (zlib::uncompress(chunk.data.substr(sizeof(recordsSize)), records, recordsSize) != zlib::StatusOK ||
+		records.size() % sizeof(FPGAAdvisorTraceRecord) != 0) {
+		raw_string_ostream error(chunk.error);
+		error << "Binary trace chunk could not be decompressed!\n";
+		return false;
+	}
+	return parse_binary_trace_records(StringRef(records.data(), records.size()), chunk);
+}
+
+// Function: parse_binary_trace_chunk
+// Return: false if unsuccessful, the error is recorded in the chunk
+// Resolves the records of an uncompressed chunk of the binary trace
+bool AdvisorAnalysis::parse_binary_trace_chunk(TraceChunk &chunk) {
+	return parse_binary_trace_records(chunk.data, chunk);
+}
+
+// Function: parse_binary_trace_records
+// Return: false if unsuccessful, the error is recorded in the chunk
+// Resolves binary trace records into the trace events of chunk. Only reads the
+// ID index, so chunks may be parsed concurrently.
+bool AdvisorAnalysis::parse_binary_trace_records(StringRef records, TraceChunk &chunk) {
+	raw_string_ostream error(chunk.error);
+	const char *ptr = records.begin();
+	for (; ptr < records.end(); ptr += sizeof(FPGAAdvisorTraceRecord)) {
+		FPGAAdvisorTraceRecord record;
+		memcpy(&record, ptr, sizeof(record));
+
+		TraceEvent event;
+		event.kind = FPGA_ADVISOR_TRACE_TAG_KIND(record.tag);
+		if (event.kind == FPGA_ADVISOR_TRACE_LOAD || event.kind == FPGA_ADVISOR_TRACE_STORE) {
+			event.function = NULL;
+			event.basicBlock = NULL;
+			event.address = FPGA_ADVISOR_TRACE_ADDRESS(record.tag, record.block);
+			event.size = FPGA_ADVISOR_TRACE_TAG_SIZE(record.tag);
+			chunk.events.push_back(event);
+			continue;
+		}
+
+		// the IDs in the trace are the positions of the functions in the module
+		// and of the basic blocks within their function
+		uint32_t funcID = FPGA_ADVISOR_TRACE_TAG_FUNC(record.tag);
+		if (funcID >= functionIndex.size()) {
+			error << "Could not find the function from trace in program!\n";
 			return false;
 		}
+
+		event.function = functionIndex[funcID];
+		event.basicBlock = NULL;
+		switch (event.kind) {
+			case FPGA_ADVISOR_TRACE_ENTER:
+			case FPGA_ADVISOR_TRACE_RETURN:
+				break;
+			case FPGA_ADVISOR_TRACE_BASICBLOCK: {
+				const std::vector<BasicBlock *> &blocks = functionMap.find(event.function)->second->bbList;
+				if (record.block >= blocks.size()) {
+					error << "Could not find the basicblock from trace in program!\n";
+					return false;
+				}
+				event.basicBlock = blocks[record.block];
+				break;
+			}
+			default:
+				error << "Unexpected binary trace record!\n";
+				return false;
+		}
+		chunk.events.push_back(event);
 	}
-	
-	// print some debug output
 
 	return true;
 }
 
+// Function: parse_program_trace
+// Return: false if unsuccessful
+// Parses the pieces of the trace with parse, a round of up to
+// -fpga-advisor-threads pieces at a time. The pieces of a round are parsed
+// concurrently by the threads of workerPool and their events are then replayed
+// in trace order, so the execution graphs are the same as if the trace was read
+// by a single thread. At most one round of events is held in memory at a time.
+// The replay is sequential, so only the time spent parsing is divided among
+// the threads.
+bool AdvisorAnalysis::parse_program_trace(std::vector<StringRef> &pieces, bool (AdvisorAnalysis::*parse)(TraceChunk &)) {
+	unsigned numThreads = get_thread_count();
+	for (unsigned first = 0; first < pieces.size(); first += numThreads) {
+		std::vector<TraceChunk> chunks(std::min(numThreads, (unsigned) pieces.size() - first));
+		for (unsigned i = 0; i < chunks.size(); i++) {
+			chunks[i].data = pieces[first + i];
+		}
+
+		// the chunks are handed out one at a time
+		std::atomic<unsigned> nextChunk(0);
+		auto worker = [&]() {
+			for (unsigned i = nextChunk++; i < chunks.size(); i = nextChunk++) {
+				(this->*parse)(chunks[i]);
+			}
+		};
+		workerPool.run(chunks.size(), worker);
+
+		for (auto chunk = chunks.begin(); chunk != chunks.end(); chunk++) {
+			for (auto event = chunk->events.begin(); event != chunk->events.end(); event++) {
+				switch (event->kind) {
+					case FPGA_ADVISOR_TRACE_ENTER:
+						add_function_call_to_trace(event->function);
+						break;
+					case FPGA_ADVISOR_TRACE_BASICBLOCK:
+						add_basic_block_to_trace(event->basicBlock);
+						break;
+					case FPGA_ADVISOR_TRACE_RETURN:
+						complete_function_call(event->function);
+						break;
+					case FPGA_ADVISOR_TRACE_LOAD:
+					case FPGA_ADVISOR_TRACE_STORE:
+						add_memory_access_to_trace(event->kind == FPGA_ADVISOR_TRACE_STORE, event->address, event->size);
+						break;
+				}
+			}
+			// the events up to the error have been replayed, as they would
+			// have been by a sequential reader
+			if (!chunk->error.empty()) {
+				errs() << chunk->error;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Function: get_indexed_program_trace
+// Return: false if unsuccessful
+// Reads the calls of each function from an indexed trace, see
+// FPGA-Advisor-Trace.h. The calls are replayed in the order they returned, so
+// each callee is kept before its caller is linked to it. When the trace is
+// streamed only the calls of the streamed function are read, the rest of the
+// trace is not touched.
+bool AdvisorAnalysis::get_indexed_program_trace(MemoryBuffer &buffer) {
+	using namespace support;
+	const unsigned char *start = (const unsigned char *) buffer.getBufferStart();
+	const unsigned char *ptr = start + FPGA_ADVISOR_TRACE_MAGIC_SIZE;
+	if (buffer.getBufferSize() < FPGA_ADVISOR_TRACE_MAGIC_SIZE + 2 * sizeof(uint32_t) + sizeof(uint64_t)) {
+		errs() << "Indexed trace is missing its header!\n";
+		return false;
+	}
+	uint32_t version = endian::readNext<uint32_t, little, unaligned>(ptr);
+	endian::readNext<uint32_t, little, unaligned>(ptr);
+	uint64_t indexOffset = endian::readNext<uint64_t, little, unaligned>(ptr);
+	if (version != FPGA_ADVISOR_INDEXED_TRACE_VERSION) {
+		errs() << "Unsupported indexed trace version " << version << "!\n";
+		return false;
+	}
+	if (indexOffset % sizeof(uint32_t) != 0 || indexOffset + 2 * sizeof(uint64_t) > buffer.getBufferSize()) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+
+	// the function of every call record is needed to link the callees, even
+	// those of functions that are not read
+	std::unique_ptr<IndexedTraceIndex> index(IndexedTraceIndex::Create(start + indexOffset, start));
+	DenseMap<Function *, std::vector<BasicBlock *> > functionBlocks;
+	DenseMap<uint64_t, Function *> recordFunctions;
+	std::vector<uint64_t> records;
+	for (auto F = mod->begin(), FE = mod->end(); F != FE; F++) {
+		std::vector<uint64_t> calls;
+		if (! read_indexed_function_entry(*index, F, functionBlocks[F], calls)) {
+			return false;
+		}
+		for (auto it = calls.begin(); it != calls.end(); it++) {
+			recordFunctions[*it] = F;
+		}
+		if (! streamFunction || &(*F) == streamFunction) {
+			records.insert(records.end(), calls.begin(), calls.end());
+		}
+	}
+
+	// the call records are written as the calls return
+	std::sort(records.begin(), records.end());
+	DenseMap<uint64_t, const TraceGraph *> keptCalls;
+	for (auto it = records.begin(); it != records.end(); it++) {
+		Function *F = recordFunctions[*it];
+		if (! read_indexed_call_record(buffer, F, functionBlocks[F], *it, recordFunctions, keptCalls)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Function: read_indexed_function_entry
+// Return: false if unsuccessful
+// Reads the index entry of F: the basic blocks of F by basic block ID of the
+// trace and the offsets of the call records of F
+bool AdvisorAnalysis::read_indexed_function_entry(IndexedTraceIndex &index, Function *F, std::vector<BasicBlock *> &blocks, std::vector<uint64_t> &calls) {
+	using namespace support;
+	IndexedTraceIndex::iterator entry = index.find(F->getName());
+	if (entry == index.end()) {
+		// F was never called
+		return true;
+	}
+
+	StringRef data = *entry;
+	const unsigned char *ptr = (const unsigned char *) data.begin();
+	const unsigned char *end = (const unsigned char *) data.end();
+
+	// map the basic block IDs of the trace to the basic blocks of F
+	if ((size_t) (end - ptr) < sizeof(uint32_t)) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	blocks.resize(endian::readNext<uint32_t, little, unaligned>(ptr));
+	for (unsigned i = 0; i < blocks.size(); i++) {
+		if ((size_t) (end - ptr) < sizeof(uint32_t)) {
+			errs() << "Indexed trace is truncated!\n";
+			return false;
+		}
+		uint32_t length = endian::readNext<uint32_t, little, unaligned>(ptr);
+		if ((size_t) (end - ptr) < length) {
+			errs() << "Indexed trace is truncated!\n";
+			return false;
+		}
+		blocks[i] = find_basicblock_by_name(F->getName(), StringRef((const char *) ptr, length));
+		ptr += length;
+	}
+
+	if ((size_t) (end - ptr) < sizeof(uint64_t)) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	uint64_t numCalls = endian::readNext<uint64_t, little, unaligned>(ptr);
+	if ((uint64_t) (end - ptr) / sizeof(uint64_t) < numCalls) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	calls.resize(numCalls);
+	for (uint64_t call = 0; call < numCalls; call++) {
+		calls[call] = endian::readNext<uint64_t, little, unaligned>(ptr);
+	}
+	return true;
+}
+
+// Function: read_indexed_call_record
+// Return: false if unsuccessful
+// Adds the call of F whose record is at offset, with its loads and stores and
+// its links to the callees. keptCalls holds the kept call of each record read
+// so far.
+bool AdvisorAnalysis::read_indexed_call_record(MemoryBuffer &buffer, Function *F, std::vector<BasicBlock *> &blocks, uint64_t offset, DenseMap<uint64_t, Function *> &recordFunctions, DenseMap<uint64_t, const TraceGraph *> &keptCalls) {
+	using namespace support;
+	const unsigned char *bufferStart = (const unsigned char *) buffer.getBufferStart();
+	const unsigned char *bufferEnd = (const unsigned char *) buffer.getBufferEnd();
+	const size_t calleeSize = sizeof(uint32_t) + sizeof(uint64_t);
+	const size_t accessSize = 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+	// the block IDs, the callees and the loads and stores of the record
+	if (offset + sizeof(uint32_t) > (uint64_t) (bufferEnd - bufferStart)) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	const unsigned char *record = bufferStart + offset;
+	uint32_t numBlocks = endian::readNext<uint32_t, little, unaligned>(record);
+	if ((uint64_t) (bufferEnd - record) / sizeof(uint32_t) < (uint64_t) numBlocks + 1) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	const unsigned char *callees = record + numBlocks * sizeof(uint32_t);
+	uint32_t numCallees = endian::readNext<uint32_t, little, unaligned>(callees);
+	if ((uint64_t) (bufferEnd - callees) / calleeSize < (uint64_t) numCallees + 1) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+	const unsigned char *accesses = callees + numCallees * calleeSize;
+	uint32_t numAccesses = endian::readNext<uint32_t, little, unaligned>(accesses);
+	if ((uint64_t) (bufferEnd - accesses) / accessSize < numAccesses) {
+		errs() << "Indexed trace is truncated!\n";
+		return false;
+	}
+
+	// the callees and the loads and stores follow the basic block that was
+	// executed last when they were recorded
+	add_function_call_to_trace(F);
+	for (uint32_t i = 0; i <= numBlocks; i++) {
+		while (numCallees > 0 && endian::read<uint32_t, little, unaligned>(callees) == i) {
+			callees += sizeof(uint32_t);
+			uint64_t calleeOffset = endian::readNext<uint64_t, little, unaligned>(callees);
+			numCallees--;
+			Function *callee = recordFunctions.lookup(calleeOffset);
+			if (!callee) {
+				errs() << "Could not find the callee from trace in program!\n";
+				return false;
+			}
+			// NULL if the callee is not kept, e.g. when the trace is streamed
+			add_callee_to_trace(F, callee, keptCalls.lookup(calleeOffset));
+		}
+		while (numAccesses > 0 && endian::read<uint32_t, little, unaligned>(accesses) == i) {
+			accesses += sizeof(uint32_t);
+			uint32_t kind = endian::readNext<uint32_t, little, unaligned>(accesses);
+			uint32_t size = endian::readNext<uint32_t, little, unaligned>(accesses);
+			uint64_t address = endian::readNext<uint64_t, little, unaligned>(accesses);
+			numAccesses--;
+			add_memory_access_to_trace(kind == FPGA_ADVISOR_TRACE_STORE, address, size);
+		}
+		if (i == numBlocks) {
+			break;
+		}
+		uint32_t blockID = endian::readNext<uint32_t, little, unaligned>(record);
+		if (blockID >= blocks.size() || !blocks[blockID]) {
+			errs() << "Could not find the basicblock from trace in program!\n";
+			return false;
+		}
+		add_basic_block_to_trace(blocks[blockID]);
+	}
+	if (numCallees > 0 || numAccesses > 0) {
+		errs() << "Indexed trace is corrupt!\n";
+		return false;
+	}
+	keptCalls[offset] = complete_function_call(F);
+	return true;
+}
+
+// Function: convert_program_trace
+// Return: false if unsuccessful
+// Converts the trace in fileIn (in any of the trace formats) into an indexed
+// trace in fileOut
+bool AdvisorAnalysis::convert_program_trace(std::string fileIn, std::string fileOut) {
+	using namespace support;
+	std::error_code EC;
+	raw_fd_ostream out(fileOut, EC, sys::fs::F_None);
+	if (EC) {
+		errs() << "Could not open indexed trace file: " << fileOut << "!\n";
+		return false;
+	}
+
+	endian::Writer<little> LE(out);
+	out.write(FPGA_ADVISOR_INDEXED_TRACE_MAGIC, FPGA_ADVISOR_TRACE_MAGIC_SIZE);
+	LE.write<uint32_t>(FPGA_ADVISOR_INDEXED_TRACE_VERSION);
+	LE.write<uint32_t>(0);
+	// the offset of the index is filled in once the index is written
+	uint64_t indexOffsetLocation = out.tell();
+	LE.write<uint64_t>(0);
+
+	IndexedTraceWriter writer(out);
+	traceWriter = &writer;
+	bool success = get_program_trace(fileIn);
+	traceWriter = NULL;
+	if (!success) {
+		return false;
+	}
+
+	uint64_t indexOffset = writer.finish();
+	out.seek(indexOffsetLocation);
+	LE.write<uint64_t>(indexOffset);
+	out.close();
+	return !out.has_error();
+}
+
+// Function: add_function_call_to_trace
+// Starts a new call instance of F in executionGraph, subsequent basic blocks
+// of F are added to this call
+void AdvisorAnalysis::add_function_call_to_trace(Function *F) {
+	if (traceWriter) {
+		traceWriter->enter_function(functionMap[F]);
+		return;
+	}
+	traceCallStack.push_back(F);
+	if (streamFunction && F != streamFunction) {
+		return;
+	}
+	TraceGraphList &graphList = executionGraph[F];
+	graphList.push_back(TraceGraph());
+	graphList.back().set_basic_block_list(&functionMap[F]->bbList);
+	// the current call of a recursive function is not necessarily the last
+	// one, so its loops are not followed
+	FunctionInfo *FI = functionMap[F];
+	if (! FI->loopList.empty() && ! is_recursive_function(F)) {
+		TraceLoopTracker tracker(FI, (LoopFoldIterations > 0) ? std::max(3u, (unsigned) LoopFoldIterations) : 0);
+		loopTrackers.insert(std::make_pair(&graphList.back(), tracker));
+	}
+}
+
+// Function: add_basic_block_to_trace
+// Appends an execution of BB to the current call of its function
+void AdvisorAnalysis::add_basic_block_to_trace(BasicBlock *BB) {
+	if (traceWriter) {
+		// the converted trace keeps every basic block, the blocks that are
+		// skipped below are skipped when the converted trace is read
+		FunctionInfo *FI = functionMap[BB->getParent()];
+		traceWriter->add_basic_block(FI, FI->bbIndex[BB]);
+		return;
+	}
+	Function *F = BB->getParent();
+	if (streamFunction && F != streamFunction) {
+		return;
+	}
+	FunctionInfo *FI = functionMap[F];
+	TraceGraph &graph = executionGraph[F].back();
+	// the tracker sees every basic block, including the ones skipped below,
+	// since loop headers often only contain a branch
+	auto tracker = loopTrackers.find(&graph);
+	if (tracker != loopTrackers.end()) {
+		tracker->second.add_basic_block(graph, FI->bbIndex[BB]);
+	}
+
+	// FIXME BOOKMARK
+	if (isa<TerminatorInst>(BB->getFirstNonPHI())) {
+		// if the basic block only contains a branch/control flow and no computation
+		// then skip it, do not add to graph
+		// TODO if this is what I end up doing, need to remove looking at these
+		// basic blocks when considering transitions ?? I think that already happens.
+		return;
+	}
+
+	// TODO We can do sanity checks here to make sure the path taken by the
+	// trace is valid
+	graph.add_vertex(FI->bbIndex[BB]);
+}
+
+// Function: add_memory_access_to_trace
+// Adds a load or store to the last executed basic block of the current call,
+// which is the innermost call on traceCallStack
+void AdvisorAnalysis::add_memory_access_to_trace(bool write, uint64_t address, unsigned size) {
+	if (traceWriter) {
+		traceWriter->add_memory_access(write, address, size);
+		return;
+	}
+	if (traceCallStack.empty()) {
+		return;
+	}
+	memoryTrace = true;
+	Function *F = traceCallStack.back();
+	if ((streamFunction && F != streamFunction) || executionGraph[F].empty()) {
+		return;
+	}
+	TraceGraph &graph = executionGraph[F].back();
+	if (graph.num_vertices() == 0) {
+		return;
+	}
+	TraceMemoryAccess access = {graph.num_vertices() - 1, write, size, address};
+	graph.add_memory_access(access);
+}
+
+// Function: complete_function_call
+// Called when the return of the current call of F is read from the trace.
+// When the trace is streamed, the call is handed to streamHandler and then
+// discarded, otherwise it is kept in executionGraph unless an identical call
+// is already there.
+// Return: the call kept in executionGraph, NULL if it is not kept
+const TraceGraph *AdvisorAnalysis::complete_function_call(Function *F) {
+	if (traceWriter) {
+		traceWriter->return_from_function(functionMap[F]);
+		return NULL;
+	}
+	// the caller is the function below F on the call stack, there is none
+	// if the trace started inside F
+	Function *caller = NULL;
+	if (! traceCallStack.empty() && traceCallStack.back() == F) {
+		traceCallStack.pop_back();
+		if (! traceCallStack.empty()) {
+			caller = traceCallStack.back();
+		}
+	}
+
+	const TraceGraph *call = NULL;
+	if (executionGraph[F].empty()) {
+		// not kept, a streamed call of another function
+	} else if (F != streamFunction) {
+		finish_loop_tracking(executionGraph[F].back());
+		// the current call of a recursive function is not necessarily the
+		// last one in executionGraph
+		if (! is_recursive_function(F)) {
+			call = merge_identical_call(F);
+		}
+	} else {
+		finish_loop_tracking(executionGraph[F].back());
+		TraceGraphList_iterator graph = std::prev(executionGraph[F].end());
+		unsigned position = streamSummary.position++;
+		if (position < streamSummary.kept.size() && streamSummary.kept[position]) {
+			// already in executionGraph, see stream_program_trace
+			executionGraph[F].pop_back();
+		} else {
+			streamSummary.calls++;
+			// the callees of F have been analyzed before F
+			update_callee_latencies(*graph);
+			std::vector<TraceGraph_vertex_descriptor> rootVertices;
+			find_maximal_configuration_for_call(F, graph, rootVertices);
+			(this->*streamHandler)(F, graph);
+			keep_streamed_call(F, position);
+		}
+	}
+
+	if (caller) {
+		add_callee_to_trace(caller, F, call);
+	}
+	return call;
+}
+
+// Function: add_callee_to_trace
+// Links the call to F that just returned to the vertex of caller that made it,
+// which is the last vertex of the current call of caller. call is the trace
+// graph of the call if it is kept in executionGraph.
+void AdvisorAnalysis::add_callee_to_trace(Function *caller, Function *F, const TraceGraph *call) {
+	if (executionGraph[caller].empty() || is_recursive_function(caller) || is_recursive_function(F)) {
+		return;
+	}
+	TraceGraph &graph = executionGraph[caller].back();
+	if (graph.num_vertices() == 0) {
+		return;
+	}
+	TraceCallee callee = {graph.num_vertices() - 1, F, call};
+	graph.add_callee(callee);
+}
+
+// Function: update_callee_latencies
+// Each vertex inherits the latency of the calls it makes, either the latency of
+// the kept call or the average latency of a call to the callee
+void AdvisorAnalysis::update_callee_latencies(TraceGraph &graph) {
+	const std::vector<TraceCallee> &callees = graph.get_callees();
+	for (auto it = callees.begin(); it != callees.end(); it++) {
+		graph.set_callee_latency(it->vertex, 0);
+	}
+	for (auto it = callees.begin(); it != callees.end(); it++) {
+		int latency = it->call ? it->call->get_call_latency() : functionMap[it->function]->callLatency;
+		graph.set_callee_latency(it->vertex, graph.get_callee_latency(it->vertex) + latency);
+	}
+}
+
+// Function: finish_loop_tracking
+// Completes the loops of a call once no more basic blocks are added to it
+void AdvisorAnalysis::finish_loop_tracking(TraceGraph &graph) {
+	auto tracker = loopTrackers.find(&graph);
+	if (tracker != loopTrackers.end()) {
+		tracker->second.finish(graph);
+		loopTrackers.erase(tracker);
+	}
+}
+
+// Function: TraceLoopTracker::add_basic_block
+// Called with each basic block of the call before its vertex is added, so the
+// vertices of an iteration are the ones added since its header was executed
+void TraceLoopTracker::add_basic_block(TraceGraph &graph, unsigned blockIndex) {
+	// the last iteration of each loop that is left ends here
+	while (! runs.empty() && ! FI->loopList[runs.back().loop].blocks.test(blockIndex)) {
+		leave_loop(graph);
+	}
+
+	int loop = FI->headerLoop[blockIndex];
+	if (loop < 0) {
+		return;
+	}
+	if (! runs.empty() && runs.back().loop == loop) {
+		complete_iteration(graph, runs.back());
+		runs.back().iterations++;
+		return;
+	}
+	// a natural loop is only entered through its header
+	TraceLoopRun run = {loop, graph.num_vertices(), graph.num_vertices(), 0, 0, 1};
+	runs.push_back(run);
+}
+
+// Function: TraceLoopTracker::finish
+void TraceLoopTracker::finish(TraceGraph &graph) {
+	while (! runs.empty()) {
+		leave_loop(graph);
+	}
+}
+
+// Function: TraceLoopTracker::leave_loop
+// Completes the innermost loop being executed and records its trip count
+void TraceLoopTracker::leave_loop(TraceGraph &graph) {
+	TraceLoopRun &run = runs.back();
+	complete_iteration(graph, run);
+	finish_identical_iterations(graph, run);
+
+	LoopIterInfo &loop = FI->loopList[run.loop];
+	if (loop.invocations == 0 || run.iterations < loop.minIter) {
+		loop.minIter = run.iterations;
+	}
+	loop.maxIter = std::max(loop.maxIter, run.iterations);
+	loop.totalIter += run.iterations;
+	loop.invocations++;
+	runs.pop_back();
+}
+
+// Function: TraceLoopTracker::complete_iteration
+// The iteration that started at run.iterationBegin has completed. If it is
+// identical to the previous kept iteration and keep iterations are already
+// kept it is removed from the graph, otherwise it is kept.
+void TraceLoopTracker::complete_iteration(TraceGraph &graph, TraceLoopRun &run) {
+	if (keep == 0) {
+		return;
+	}
+	unsigned length = graph.num_vertices() - run.iterationBegin;
+	bool identical = run.kept > 0 && length > 0 && length == run.iterationBegin - run.previousBegin
+		&& graph.same_vertices(run.previousBegin, run.iterationBegin, length);
+	// iterations containing a folded inner loop are not folded themselves,
+	// the folds are in vertex order so only the last one can be inside
+	const std::vector<TraceLoopFold> &folds = graph.get_loop_folds();
+	if (identical && ! folds.empty() && folds.back().begin >= run.previousBegin) {
+		identical = false;
+	}
+
+	if (! identical) {
+		finish_identical_iterations(graph, run);
+		run.kept = 1;
+	} else if (run.kept >= keep) {
+		graph.truncate_vertices(run.iterationBegin);
+		run.folded++;
+		return;
+	} else {
+		run.kept++;
+	}
+	run.previousBegin = run.iterationBegin;
+	run.iterationBegin = graph.num_vertices();
+}
+
+// Function: TraceLoopTracker::finish_identical_iterations
+// Records the iterations removed from the current run of identical iterations
+void TraceLoopTracker::finish_identical_iterations(TraceGraph &graph, TraceLoopRun &run) {
+	if (run.folded > 0) {
+		TraceLoopFold fold = {run.previousBegin, run.iterationBegin - run.previousBegin, run.kept, run.folded};
+		graph.add_loop_fold(fold);
+	}
+	run.folded = 0;
+}
+
+// Function: merge_identical_call
+// Return: the call that represents the last call to F
+// Removes the last call to F from executionGraph if a previous call executed the
+// same basic block sequence, the multiplicity of that call is incremented
+// instead. Only the distinct calls are analyzed and their latencies are
+// weighted by their multiplicity.
+TraceGraph *AdvisorAnalysis::merge_identical_call(Function *F) {
+	TraceGraphList &graphList = executionGraph[F];
+	TraceGraphList_iterator call = std::prev(graphList.end());
+	size_t hash = call->hash_basic_blocks();
+
+	std::unordered_multimap<size_t, TraceGraphList_iterator> &calls = callIndex[F];
+	auto range = calls.equal_range(hash);
+	for (auto it = range.first; it != range.second; it++) {
+		if (it->second->same_basic_blocks(*call)) {
+			it->second->add_identical_call();
+			graphList.pop_back();
+			return &*it->second;
+		}
+	}
+	calls.insert(std::make_pair(hash, call));
+	return &*call;
+}
+
+// Function: keep_streamed_call
+// Keeps the streamed call of F that just returned in executionGraph, merged
+// with an identical call if there is one, as long as the kept calls fit
+// within -stream-trace-cache vertices. Only the first pass over the trace keeps
+// calls, the calls of recursive functions are never kept.
+void AdvisorAnalysis::keep_streamed_call(Function *F, unsigned position) {
+	TraceGraph &graph = executionGraph[F].back();
+	bool keep = position == streamSummary.kept.size() && ! is_recursive_function(F)
+		&& streamSummary.keptVertices + graph.num_vertices() <= StreamTraceCache;
+	if (position == streamSummary.kept.size()) {
+		streamSummary.kept.push_back(keep);
+	}
+	if (keep) {
+		streamSummary.keptVertices += graph.num_vertices();
+		merge_identical_call(F);
+	} else {
+		streamSummary.complete = false;
+		executionGraph[F].pop_back();
+	}
+}
+
+// Function: start_streamed_function
+// Forgets the calls kept from the previous streamed function, the next pass
+// over the trace is the first one for F
+void AdvisorAnalysis::start_streamed_function(Function *F) {
+	executionGraph[F].clear();
+	callIndex[F].clear();
+	streamSummary.kept.clear();
+	streamSummary.keptVertices = 0;
+	streamSummary.complete = false;
+}
+
+// Function: stream_program_trace
+// Return: false if unsuccessful
+// Reads the trace file again and passes each call to F to handler as soon as
+// the call returns. Only the calls to F that are still executing and the calls
+// kept by the first pass (see keep_streamed_call) are held in memory, so the
+// memory needed is bounded by the largest call and -stream-trace-cache rather
+// than by the whole trace. The kept calls are passed to handler from
+// executionGraph, and the trace is not read again once all calls are kept.
+// The results must be accumulated by the handler, e.g. in streamSummary, and
+// weighted by the multiplicity of each call.
+bool AdvisorAnalysis::stream_program_trace(Function *F, bool (AdvisorAnalysis::*handler)(Function *, TraceGraphList_iterator)) {
+	streamFunction = F;
+	streamHandler = handler;
+	streamSummary.calls = 0;
+	streamSummary.position = 0;
+	bool firstPass = streamSummary.kept.empty();
+	if (firstPass) {
+		streamSummary.complete = true;
+	}
+
+	bool success = true;
+	if (firstPass || ! streamSummary.complete) {
+		// the trip counts of the loops of F are counted again by each pass
+		std::vector<LoopIterInfo> &loops = functionMap[F]->loopList;
+		for (auto it = loops.begin(); it != loops.end(); it++) {
+			it->invocations = 0;
+			it->minIter = 0;
+			it->totalIter = 0;
+			it->maxIter = 0;
+		}
+
+		success = get_program_trace(traceFileName);
+		// calls that never returned (e.g. the program exited from within
+		// F) are completed at the end of the trace
+		while (success && executionGraph[F].size() > callIndex[F].size()) {
+			complete_function_call(F);
+		}
+
+		// a trace that could not be read may leave calls of other
+		// functions open
+		loopTrackers.clear();
+		traceCallStack.clear();
+		executionGraph[F].resize(callIndex[F].size());
+	}
+
+	// the first pass has already handled the calls it kept
+	if (success && ! firstPass) {
+		for (auto graph = executionGraph[F].begin(); graph != executionGraph[F].end(); graph++) {
+			streamSummary.calls += graph->get_multiplicity();
+			(this->*handler)(F, graph);
+		}
+	}
+	streamFunction = NULL;
+	return success;
+}
+
 /*
 // TODO TODO TODO TODO TODO remember to check for external functions, I know
 // you're going to forget this!!!!!!!!
@@ -749,35 +1626,48 @@ bool AdvisorAnalysis::trace_cfg(BasicBlock *startBB) {
 }
 */
 
-// TODO: there's probably a much better way than this...
-// TODO: but I need to show results!!!
-// Function: find_basicblock_by_name
-// Return: Pointer to the basic block belonging to function and basic block, NULL if
-// not found
-BasicBlock *AdvisorAnalysis::find_basicblock_by_name(std::string funcName, std::string bbName) {
+// Function: build_name_index
+// Builds the lookup tables used to resolve function and basic block names from
+// the text trace and function IDs from the binary trace
+void AdvisorAnalysis::build_name_index() {
+	functionNameIndex.clear();
+	basicBlockNameIndex.clear();
+	functionIndex.clear();
 	for (auto F = mod->begin(), FE = mod->end(); F != FE; F++) {
-		if (strcmp(funcName.c_str(), F->getName().str().c_str()) != 0) {
-			continue;
-		}
+		functionNameIndex[F->getName()] = F;
+		functionIndex.push_back(F);
+		StringMap<BasicBlock *> &blocks = basicBlockNameIndex[F];
 		for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
-			if (strcmp(bbName.c_str(), BB->getName().str().c_str()) == 0) {
-				return BB;
-			}
+			blocks[BB->getName()] = BB;
 		}
 	}
-	return NULL;
+}
+
+// Function: find_basicblock_by_name
+// Return: Pointer to the basic block belonging to function and basic block, NULL if
+// not found
+BasicBlock *AdvisorAnalysis::find_basicblock_by_name(StringRef funcName, StringRef bbName) {
+	Function *F = find_function_by_name(funcName);
+	if (!F) {
+		return NULL;
+	}
+	// the index is only read here, the trace may be parsed concurrently
+	const StringMap<BasicBlock *> &blocks = basicBlockNameIndex.find(F)->second;
+	auto search = blocks.find(bbName);
+	if (search == blocks.end()) {
+		return NULL;
+	}
+	return search->getValue();
 }
 
 // Function: find_function_by_name
 // Return: Pointer to the function belonging to function, NULL if not found
-Function *AdvisorAnalysis::find_function_by_name(std::string funcName) {
-	for (auto F = mod->begin(), FE = mod->end(); F != FE; F++) {
-		if (strcmp(funcName.c_str(), F->getName().str().c_str()) != 0) {
-			continue;
-		}
-		return F;
+Function *AdvisorAnalysis::find_function_by_name(StringRef funcName) {
+	auto search = functionNameIndex.find(funcName);
+	if (search == functionNameIndex.end()) {
+		return NULL;
 	}
-	return NULL;
+	return search->getValue();
 }
 
 // Function: find_maximal_configuration_for_all_calls
@@ -785,78 +1675,218 @@ Function *AdvisorAnalysis::find_function_by_name(std::string funcName) {
 // This function will find the maximum needed tiling for a given function
 // across all individual calls within the trace
 // Does not look across function boundaries
-// The parallelization factor will be stored in metadata for each basicblock
+// The parallelization factor will be stored in FunctionInfo::repFactor for each basicblock
 bool AdvisorAnalysis::find_maximal_configuration_for_all_calls(Function *F) {
 	*outputLog << __func__ << " for function " << F->getName() << "\n";;
 	//assert(executionTrace.find(F) != executionTrace.end());
 	assert(executionGraph.find(F) != executionGraph.end());
-	assert(executionOrderListMap.find(F) != executionOrderListMap.end());
 	bool scheduled = false;
 
 	initialize_basic_block_instance_count(F);
 
+	if (StreamTrace) {
+		// the replication factors hold the peak concurrency over the calls
+		// seen so far
+		start_streamed_function(F);
+		scheduled = stream_program_trace(F, &AdvisorAnalysis::find_maximal_schedule_for_call);
+		*outputLog << "There are " << streamSummary.calls << " calls to " << F->getName() << "\n";
+		return scheduled;
+	}
+
 	// The ending condition should be determined by the user input of acceptable
 	// area and latency constraints
 	//while (1) {
 		// iterate over all calls
-		*outputLog << "There are " << executionGraph[F].size() << " calls to " << F->getName() << "\n";
+		*outputLog << "There are " << executionGraph[F].size() << " distinct calls to " << F->getName() << "\n";
 		TraceGraphList_iterator fIt;
-		ExecutionOrderList_iterator eoIt;
-		for (fIt = executionGraph[F].begin(),
-				eoIt = executionOrderListMap[F].begin(); 
-				fIt != executionGraph[F].end(),
-				eoIt != executionOrderListMap[F].end(); fIt++, eoIt++) {
+		for (fIt = executionGraph[F].begin(); fIt != executionGraph[F].end(); fIt++) {
 			std::vector<TraceGraph_vertex_descriptor> rootVertices;
-			rootVertices.clear();
-			scheduled |= find_maximal_configuration_for_call(F, fIt, eoIt, rootVertices);
-			//scheduled |= find_maximal_configuration_for_call(F, fIt, rootVertices);
-			// after creating trace graphs representing maximal parallelism
-			// compute maximal tiling
-			//find_maximal_tiling_for_call(F, fIt);
+			scheduled |= find_maximal_configuration_for_call(F, fIt, rootVertices);
+			scheduled |= find_maximal_schedule_for_call(F, fIt);
+		}
+	//}
 
-			// find root vertices
-			find_root_vertices(rootVertices, fIt);
+	return scheduled;
+}
 
-			TraceGraph graph = *fIt;
-			*outputLog << "root vertices are: ";
-			for (auto rV = rootVertices.begin(); rV != rootVertices.end(); rV++) {
-				*outputLog << "root: [" << *rV << "]->" << graph[*rV].name << "\n";
-			}
-	
-			int lastCycle = -1;
-	
-			// annotate each node with the start and end cycles
-			scheduled |= annotate_schedule_for_call(F, fIt, rootVertices, lastCycle);
-	
-			*outputLog << "Last Cycle: " << lastCycle << "\n";
+// Function: find_maximal_schedule_for_call
+// Return: true if scheduled
+// Builds the trace graph of one call, schedules it without resource
+// constraints and raises the replication factors of F to the maximum number of
+// concurrent executions of each basic block in the call
+bool AdvisorAnalysis::find_maximal_schedule_for_call(Function *F, TraceGraphList_iterator graph_it) {
+	bool scheduled = false;
+	std::vector<TraceGraph_vertex_descriptor> rootVertices;
+	// the dependences of the call have been found by
+	// find_maximal_configuration_for_call
+	// after creating trace graphs representing maximal parallelism
+	// compute maximal tiling
+	//find_maximal_tiling_for_call(F, graph_it);
+
+	// find root vertices
+	find_root_vertices(rootVertices, graph_it);
+
+	TraceGraph &graph = *graph_it;
+	*outputLog << "root vertices are: ";
+	for (auto rV = rootVertices.begin(); rV != rootVertices.end(); rV++) {
+		*outputLog << "root: [" << *rV << "]->" << graph.get_basic_block(*rV)->getName() << "\n";
+	}
 
-			// after creating trace graphs, find maximal resources needed
-			// to satisfy longest antichain
-			scheduled |= find_maximal_resource_requirement(F, fIt, rootVertices, lastCycle);
-	
-			// use gradient descent method
-			//modify_resource_requirement(F, fIt);
+	int lastCycle = -1;
 
-		}
-	//}
+	// annotate each node with the start and end cycles
+	scheduled |= annotate_schedule_for_call(F, graph_it, rootVertices, lastCycle);
+
+	*outputLog << "Last Cycle: " << lastCycle << "\n";
+
+	// after creating trace graphs, find maximal resources needed
+	// to satisfy longest antichain
+	scheduled |= find_maximal_resource_requirement(F, graph_it, rootVertices, lastCycle);
+
+	find_parallel_iterations_for_call(F, graph_it);
+
+	// use gradient descent method
+	//modify_resource_requirement(F, graph_it);
 
 	return scheduled;
 }
 
-bool AdvisorAnalysis::find_maximal_configuration_for_call(Function *F, TraceGraphList_iterator graph, ExecutionOrderList_iterator execOrder, std::vector<TraceGraph_vertex_descriptor> &rootVertices) {
+// Function: max_overlapping_iterations
+// Return: the largest number of the iterations that execute in the same cycle,
+// each iteration is given by its first and last cycle
+static uint64_t max_overlapping_iterations(std::vector<std::pair<int, int> > &iterations) {
+	std::vector<int> first, last;
+	for (auto it = iterations.begin(); it != iterations.end(); it++) {
+		first.push_back(it->first);
+		last.push_back(it->second);
+	}
+	std::sort(first.begin(), first.end());
+	std::sort(last.begin(), last.end());
+
+	uint64_t overlap = 0;
+	unsigned ended = 0;
+	for (unsigned i = 0; i < first.size(); i++) {
+		while (last[ended] < first[i]) {
+			ended++;
+		}
+		overlap = std::max(overlap, (uint64_t) (i + 1 - ended));
+	}
+	return overlap;
+}
+
+// Function: find_parallel_iterations_for_call
+// Raises the parIter of each loop of F to the largest number of iterations of
+// one execution of the loop that overlap in the maximal schedule of the call.
+// Iterations start at the vertices of the loop header, the header of a loop
+// that only contains a branch has no vertex and its iterations are not seen.
+void AdvisorAnalysis::find_parallel_iterations_for_call(Function *F, TraceGraphList_iterator graph_it) {
+	FunctionInfo *FI = functionMap[F];
+	TraceGraph &graph = *graph_it;
+
+	// the loops being executed, innermost last, with the first and last
+	// cycle of each of their iterations so far
+	std::vector<std::pair<int, std::vector<std::pair<int, int> > > > loops;
+	for (TraceGraph_vertex_descriptor v = 0; v <= graph.num_vertices(); v++) {
+		// a past the end vertex leaves all loops
+		int blockIndex = (v < graph.num_vertices()) ? (int) graph.get_block_index(v) : -1;
+		while (! loops.empty() && (blockIndex < 0 || ! FI->loopList[loops.back().first].blocks.test(blockIndex))) {
+			LoopIterInfo &loop = FI->loopList[loops.back().first];
+			loop.parIter = std::max(loop.parIter, max_overlapping_iterations(loops.back().second));
+			loops.pop_back();
+		}
+		if (blockIndex < 0) {
+			break;
+		}
+
+		int loop = FI->headerLoop[blockIndex];
+		if (loop >= 0) {
+			if (loops.empty() || loops.back().first != loop) {
+				loops.push_back(std::make_pair(loop, std::vector<std::pair<int, int> >()));
+			}
+			loops.back().second.push_back(std::make_pair(graph.minCycStart[v], graph.minCycEnd[v]));
+		}
+		// the vertex belongs to the current iteration of every loop
+		for (auto it = loops.begin(); it != loops.end(); it++) {
+			if (! it->second.empty()) {
+				std::pair<int, int> &iteration = it->second.back();
+				iteration.first = std::min(iteration.first, graph.minCycStart[v]);
+				iteration.second = std::max(iteration.second, graph.minCycEnd[v]);
+			}
+		}
+	}
+}
+
+bool AdvisorAnalysis::find_maximal_configuration_for_call(Function *F, TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &rootVertices) {
 	*outputLog << __func__ << " for function " << F->getName() << "\n";
 
-	print_execution_order(execOrder);
+	FunctionInfo *FI = functionMap[F];
+
+	// lastExecution keeps track of the most recent execution of each basic block
+	// (by basic block index) while the trace is walked in execution order, -1 if
+	// the basic block has not been executed yet
+	std::vector<int> lastExecution(FI->bbList.size(), -1);
+
+	// with loop carried dependences (see DepGraphEdge), the loops being
+	// executed, innermost last, with the first vertex of each of their
+	// iterations in the current execution of the loop, and all executions of
+	// the basic blocks that carried dependences point to, by basic block index
+	bool loopCarried = (*depGraph)[boost::graph_bundle].loopCarried;
+	std::vector<std::pair<int, std::vector<TraceGraph_vertex_descriptor> > > loops;
+	std::vector<std::vector<TraceGraph_vertex_descriptor> > executions;
+	std::vector<bool> carriedTarget;
+	if (loopCarried) {
+		executions.resize(FI->bbList.size());
+		carriedTarget.assign(FI->bbList.size(), false);
+		DepGraph_edge_iterator ei, ee;
+		for (boost::tie(ei, ee) = boost::edges(*depGraph); ei != ee; ei++) {
+			if ((*depGraph)[*ei].carrier) {
+				carriedTarget[FI->bbIndex[(*depGraph)[boost::target(*ei, *depGraph)]]] = true;
+			}
+		}
+	}
 
-	TraceGraph_iterator vi, ve;
-	for (boost::tie(vi, ve) = boost::vertices(*graph); vi != ve; vi++) {
-		TraceGraph_vertex_descriptor self = *vi;
-		BasicBlock *selfBB = (*graph)[self].basicblock;
+	// with a memory trace, the dependences through memory between basic
+	// blocks whose only memory instructions are loads and stores (tracedMemory,
+	// by basic block index) are the ones that occurred: a load depends on the
+	// last store to each of its bytes, a store also on the loads since then.
+	// shadow holds that state for each byte accessed so far.
+	const std::vector<TraceMemoryAccess> &accesses = graph->get_memory_accesses();
+	auto access = accesses.begin();
+	TraceShadow shadow;
+	std::vector<bool> tracedMemory;
+	if (memoryTrace) {
+		DepGraphIndex &index = (*depGraph)[boost::graph_bundle];
+		for (auto BB = FI->bbList.begin(); BB != FI->bbList.end(); BB++) {
+			tracedMemory.push_back(! index.otherMemory.test(index.vertex[*BB]));
+		}
+	}
+
+	graph->clear_edges();
+	dependenceReduction.reset(graph->num_vertices());
+
+	for (TraceGraph_vertex_descriptor self = 0; self < graph->num_vertices(); self++) {
+		BasicBlock *selfBB = graph->get_basic_block(self);
 		*outputLog << "Inspecting vertex (" << self << ") " << selfBB->getName() << "\n";
 
+		if (loopCarried) {
+			// the vertex of a loop header starts an iteration, like in
+			// find_parallel_iterations_for_call
+			unsigned blockIndex = graph->get_block_index(self);
+			while (! loops.empty() && ! FI->loopList[loops.back().first].blocks.test(blockIndex)) {
+				loops.pop_back();
+			}
+			int loop = FI->headerLoop[blockIndex];
+			if (loop >= 0) {
+				if (loops.empty() || loops.back().first != loop) {
+					loops.push_back(std::make_pair(loop, std::vector<TraceGraph_vertex_descriptor>()));
+				}
+				loops.back().second.push_back(self);
+			}
+		}
+
 		// staticDeps vector keeps track of basic blocks that this basic block is 
 		// dependent on
-		std::vector<BasicBlock *> staticDeps;
+		std::vector<std::pair<BasicBlock *, const DepGraphEdge *> > staticDeps;
 		staticDeps.clear();
 		DependenceGraph::get_all_basic_block_dependencies(*depGraph, selfBB, staticDeps);
 
@@ -865,31 +1895,77 @@ bool AdvisorAnalysis::find_maximal_configuration_for_call(Function *F, TraceGrap
 		// dynamicDeps vector keeps track of vertices in dynamic execution trace
 		std::vector<TraceGraph_vertex_descriptor> dynamicDeps;
 		dynamicDeps.clear();
+		// with InstructionDependences, the ready offset of each dynamic
+		// dependence (see TraceGraph::get_ready_offset)
+		std::vector<int> readyOffsets;
 
 		// fill the dynamicDeps vector by finding the most recent past execution of the
 		// dependent basic blocks in the dynamic trace
 		for (auto sIt = staticDeps.begin(); sIt != staticDeps.end(); sIt++) {
-			BasicBlock *depBB = *sIt;
-			// find corresponding execution order vector
-			auto search = (*execOrder).find(depBB);
-			*outputLog << "Some\n";
-			assert(search != (*execOrder).end());
-
-			int currExec = search->second.first;
-			std::vector<TraceGraph_vertex_descriptor> &execOrderVec = search->second.second;
-			*outputLog << "Thing\n";
-			*outputLog << currExec << " " << execOrderVec.size() << "\n";
-			assert((int) currExec <= (int) execOrderVec.size());
-			*outputLog << "old\n";
-
+			BasicBlock *depBB = sIt->first;
+			if (memoryTrace && sIt->second->memory && tracedMemory[FI->bbIndex[selfBB]] && tracedMemory[FI->bbIndex[depBB]]) {
+				// replaced by the memory trace
+				continue;
+			}
+			int currExec = lastExecution[FI->bbIndex[depBB]];
+			if (sIt->second->carrier) {
+				// find the execution of the carrier loop that the vertex belongs
+				// to, the loop is not found if its header has no vertex and then
+				// the most recent execution is used
+				int loop = FI->headerLoop[FI->bbIndex[sIt->second->carrier]];
+				auto lIt = loops.rbegin();
+				while (lIt != loops.rend() && lIt->first != loop) {
+					lIt++;
+				}
+				if (lIt != loops.rend()) {
+					// the last execution of depBB in the iteration distance
+					// iterations earlier, if it exists
+					std::vector<TraceGraph_vertex_descriptor> &starts = lIt->second;
+					unsigned distance = sIt->second->distance;
+					currExec = -1;
+					if (starts.size() > distance) {
+						unsigned iteration = starts.size() - 1 - distance;
+						TraceGraph_vertex_descriptor begin = starts[iteration];
+						TraceGraph_vertex_descriptor end = starts[iteration + 1];
+						std::vector<TraceGraph_vertex_descriptor> &depExecutions = executions[FI->bbIndex[depBB]];
+						auto eIt = std::lower_bound(depExecutions.begin(), depExecutions.end(), end);
+						if (eIt != depExecutions.begin() && *(eIt - 1) >= begin) {
+							currExec = *(eIt - 1);
+						}
+					}
+				}
+			}
 			if (currExec < 0) {
 				*outputLog << "Dependent basic block hasn't been executed yet. " << depBB->getName() << "\n";
 				// don't append dynamic dependence
 			} else {
 				// the dependent basic block has been executed before this basic block, so possibly
 				// need to add a dependence edge
-				TraceGraph_vertex_descriptor dynDep = execOrderVec[currExec];
-				dynamicDeps.push_back(dynDep);
+				dynamicDeps.push_back((TraceGraph_vertex_descriptor) currExec);
+				if (InstructionDependences) {
+					readyOffsets.push_back(get_ready_offset(FI, *sIt->second, FI->bbIndex[depBB]));
+				}
+			}
+		}
+
+		if (memoryTrace) {
+			while (access != accesses.end() && access->vertex < self) {
+				access++;
+			}
+			auto first = access;
+			unsigned staticCount = dynamicDeps.size();
+			for (; access != accesses.end() && access->vertex == self; access++) {
+				shadow.add_dependences(*access, dynamicDeps);
+			}
+			*outputLog << "Found number of memory dependences: " << dynamicDeps.size() - staticCount << "\n";
+			// the instructions that made the accesses are not known
+			for (unsigned i = readyOffsets.size(); InstructionDependences && i < dynamicDeps.size(); i++) {
+				readyOffsets.push_back(FI->latency[graph->get_block_index(dynamicDeps[i])]);
+			}
+
+			// the accesses of the vertex only affect later vertices
+			for (auto it = first; it != access; it++) {
+				shadow.update(*it);
 			}
 		}
 
@@ -898,68 +1974,268 @@ bool AdvisorAnalysis::find_maximal_configuration_for_call(Function *F, TraceGrap
 		// remove redundant dynamic dependence entries
 		// these are the dynamic dependences which another dynamic dependence is directly
 		// or indirectly dependent on
-		remove_redundant_dynamic_dependencies(graph, dynamicDeps);
+		// with InstructionDependences a dependence that is an ancestor of
+		// another one may still be the one that is ready last, so only the
+		// duplicates are removed
+		if (InstructionDependences) {
+			remove_duplicate_dependences(dynamicDeps, readyOffsets);
+		} else {
+			remove_redundant_dynamic_dependencies(graph, self, dynamicDeps);
+		}
 
 		*outputLog << "Found number of dynamic dependences (after): " << dynamicDeps.size() << "\n";
 		
 		// add dependency edges to graph
-		for (auto it = dynamicDeps.begin(); it != dynamicDeps.end(); it++) {
-			boost::add_edge(*it, self, *graph);
+		for (unsigned i = 0; i < dynamicDeps.size(); i++) {
+			if (InstructionDependences) {
+				graph->add_in_edge(self, dynamicDeps[i], readyOffsets[i]);
+			} else {
+				graph->add_in_edge(self, dynamicDeps[i]);
+			}
+		}
+		graph->close_in_edges(self);
+
+		// update the most recent execution of the current basic block after it has been processed
+		lastExecution[graph->get_block_index(self)] = self;
+		if (loopCarried && carriedTarget[graph->get_block_index(self)]) {
+			executions[graph->get_block_index(self)].push_back(self);
+		}
+	}
+
+	// the graph is complete, build the out-edges
+	graph->finalize();
+	return true;
+}
+
+
+// Function: remove_redundant_dynamic_dependencies
+// Given a dynamic trace graph and a vector of vertices for which a executed basic block is
+// dependent, remove the dependent vertices which are redundant. A redundant vertices are 
+// those which are depended on by other dependent vertices.
+// The remaining dependences are left sorted in reverse order.
+void AdvisorAnalysis::remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, TraceGraph_vertex_descriptor self, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps) {
+	dependenceReduction.reduce(*graph, self, dynamicDeps);
+}
+
+
+// Function: TraceGraph::same_vertices
+bool TraceGraph::same_vertices(TraceGraph_vertex_descriptor a, TraceGraph_vertex_descriptor b, unsigned length) const {
+	if (! std::equal(block.begin() + a, block.begin() + a + length, block.begin() + b)) {
+		return false;
+	}
+	// the callees of the vertices from a and from b, at the same offsets
+	auto first = [](const TraceCallee &callee, TraceGraph_vertex_descriptor v) { return callee.vertex < v; };
+	auto calleeA = std::lower_bound(callees.begin(), callees.end(), a, first);
+	auto calleeB = std::lower_bound(callees.begin(), callees.end(), b, first);
+	for (; calleeA != callees.end() && calleeA->vertex < a + length; calleeA++, calleeB++) {
+		if (calleeB == callees.end() || calleeB->vertex - b != calleeA->vertex - a
+			|| calleeB->function != calleeA->function || calleeB->call != calleeA->call) {
+			return false;
+		}
+	}
+	if (calleeB != callees.end() && calleeB->vertex < b + length) {
+		return false;
+	}
+	// the memory accesses, at the same offsets and addresses
+	auto firstAccess = [](const TraceMemoryAccess &access, TraceGraph_vertex_descriptor v) { return access.vertex < v; };
+	auto accessA = std::lower_bound(memoryAccesses.begin(), memoryAccesses.end(), a, firstAccess);
+	auto accessB = std::lower_bound(memoryAccesses.begin(), memoryAccesses.end(), b, firstAccess);
+	for (; accessA != memoryAccesses.end() && accessA->vertex < a + length; accessA++, accessB++) {
+		if (accessB == memoryAccesses.end() || accessB->vertex - b != accessA->vertex - a
+			|| accessB->write != accessA->write || accessB->size != accessA->size || accessB->address != accessA->address) {
+			return false;
+		}
+	}
+	return accessB == memoryAccesses.end() || accessB->vertex >= b + length;
+}
+
+// Function: TraceShadow::get_page
+// Return: the page holding address, NULL if there is none and create is not set
+TraceShadow::TraceShadowPage *TraceShadow::get_page(uint64_t address, bool create) {
+	auto search = pageIndex.find(address >> PageBits);
+	if (search != pageIndex.end()) {
+		return pages[search->second].get();
+	}
+	if (! create) {
+		return NULL;
+	}
+	TraceShadowPage *page = new TraceShadowPage;
+	std::fill(page->store, page->store + PageSize, -1);
+	std::fill(page->loads, page->loads + PageSize, -1);
+	pageIndex[address >> PageBits] = pages.size();
+	pages.push_back(std::unique_ptr<TraceShadowPage>(page));
+	return page;
+}
+
+// Function: TraceShadow::add_dependences
+// An access depends on the last store to each of its bytes, a store also on
+// the loads of each byte since then. The bytes that share their store or load
+// list with the previous byte add nothing new.
+void TraceShadow::add_dependences(const TraceMemoryAccess &access, std::vector<TraceGraph_vertex_descriptor> &deps) {
+	int lastStore = -1;
+	int lastLoads = -1;
+	uint64_t end = access.address + access.size;
+	for (uint64_t address = access.address; address < end; ) {
+		uint64_t pageEnd = std::min(end, ((address >> PageBits) + 1) << PageBits);
+		TraceShadowPage *page = get_page(address, false);
+		for (; page && address < pageEnd; address++) {
+			unsigned offset = address & (PageSize - 1);
+			int store = page->store[offset];
+			if (store >= 0 && store != lastStore) {
+				deps.push_back((TraceGraph_vertex_descriptor) store);
+				lastStore = store;
+			}
+			int loads = page->loads[offset];
+			if (access.write && loads != lastLoads) {
+				for (int node = loads; node >= 0; node = loadNodes[node].second) {
+					deps.push_back(loadNodes[node].first);
+				}
+				lastLoads = loads;
+			}
 		}
-
-		// update the execution order index for current basic block after it has been processed
-		auto search = (*execOrder).find(selfBB);
-		assert(search != (*execOrder).end());
-		search->second.first++;
+		address = pageEnd;
 	}
 }
 
-void AdvisorAnalysis::print_execution_order(ExecutionOrderList_iterator execOrder) {
-	*outputLog << "Execution Order: \n";
-	for (auto it = (*execOrder).begin(); it != (*execOrder).end(); it++) {
-		*outputLog << it->first->getName() << " ";
-		for (auto eit = it->second.second.begin(); eit != it->second.second.end(); eit++) {
-			*outputLog << *eit << " ";
+// Function: TraceShadow::update
+// A store replaces the state of its bytes, a load is added to the load list
+// of each byte unless its vertex is already the first one. The bytes whose
+// list was shared before the load share the new node as well.
+void TraceShadow::update(const TraceMemoryAccess &access) {
+	int lastLoads = -1;
+	int lastNode = -1;
+	uint64_t end = access.address + access.size;
+	for (uint64_t address = access.address; address < end; ) {
+		uint64_t pageEnd = std::min(end, ((address >> PageBits) + 1) << PageBits);
+		TraceShadowPage *page = get_page(address, true);
+		for (; address < pageEnd; address++) {
+			unsigned offset = address & (PageSize - 1);
+			if (access.write) {
+				page->store[offset] = access.vertex;
+				page->loads[offset] = -1;
+				continue;
+			}
+			int loads = page->loads[offset];
+			if (loads >= 0 && loadNodes[loads].first == access.vertex) {
+				continue;
+			}
+			if (lastNode < 0 || loads != lastLoads) {
+				lastNode = loadNodes.size();
+				loadNodes.push_back(std::make_pair(access.vertex, loads));
+				lastLoads = loads;
+			}
+			page->loads[offset] = lastNode;
 		}
-		*outputLog << "\n";
 	}
 }
 
+// Function: TraceGraph::finalize
+// Builds the out-edge arrays from the in-edges once all vertices and edges
+// have been added, and allocates the schedule and transition delay arrays.
+// The out-edges of each vertex are sorted by target.
+void TraceGraph::finalize() {
+	unsigned numVertices = num_vertices();
+	assert(inOffset.size() == numVertices + 1);
+
+	// count the out degree of each vertex and convert to offsets
+	outOffset.assign(numVertices + 1, 0);
+	for (auto it = inSource.begin(); it != inSource.end(); it++) {
+		outOffset[*it + 1]++;
+	}
+	for (unsigned v = 0; v < numVertices; v++) {
+		outOffset[v + 1] += outOffset[v];
+	}
+
+	outTarget.resize(inSource.size());
+	outEdge.resize(inSource.size());
+	std::vector<unsigned> fill(outOffset.begin(), outOffset.end() - 1);
+	for (TraceGraph_vertex_descriptor v = 0; v < numVertices; v++) {
+		for (TraceGraph_edge_descriptor e = in_begin(v); e != in_end(v); e++) {
+			unsigned i = fill[inSource[e]]++;
+			outTarget[i] = v;
+			outEdge[i] = e;
+		}
+	}
 
-// sort trace graph vertex descriptor vector in reverse order
-bool reverse_vertex_sort(TraceGraph_vertex_descriptor a, TraceGraph_vertex_descriptor b) {
-	return b < a;
+	delay.assign(inSource.size(), 0);
+	minCycStart.assign(numVertices, -1);
+	minCycEnd.assign(numVertices, -1);
+	cycStart.assign(numVertices, -1);
+	cycEnd.assign(numVertices, -1);
 }
 
-// Function: remove_redundant_dynamic_dependencies
-// Given a dynamic trace graph and a vector of vertices for which a executed basic block is
-// dependent, remove the dependent vertices which are redundant. A redundant vertices are 
-// those which are depended on by other dependent vertices.
-void AdvisorAnalysis::remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps) {
-	// sort in reverse order, may have more chance to find and remove redundancies if
-	// we start with vertices that executed later
-	std::sort(dynamicDeps.begin(), dynamicDeps.end(), reverse_vertex_sort);
 
-	for (auto it = dynamicDeps.begin(); it != dynamicDeps.end(); it++) {
-		TraceGraph_vertex_descriptor v = *it;
-		recursively_remove_redundant_dynamic_dependencies(graph, dynamicDeps, it, v);
+// Function: TransitiveReduction::reduce
+// Removes every dependence in deps of vertex self that is an ancestor of
+// another dependence in deps (or a duplicate). Dependences are examined from
+// the latest executed to the earliest, the ancestors of each kept dependence
+// are marked and any later examined dependence that has been marked is
+// redundant.
+void TransitiveReduction::reduce(TraceGraph &graph, TraceGraph_vertex_descriptor self, std::vector<TraceGraph_vertex_descriptor> &deps) {
+	// the vertices before self that were not reduced have no shortcuts
+	while (shortcutOffset.size() <= self) {
+		shortcutOffset.push_back(shortcuts.size());
 	}
-}
 
+	if (deps.empty()) {
+		return;
+	}
 
-void AdvisorAnalysis::recursively_remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps, std::vector<TraceGraph_vertex_descriptor>::iterator search, TraceGraph_vertex_descriptor v) {
-	// if v already exists as a parent/ancestor, remove from list because it is redundant
-	std::vector<TraceGraph_vertex_descriptor>::iterator found = std::find(search+1, dynamicDeps.end(), v);
-	if (found != dynamicDeps.end()) {
-		dynamicDeps.erase(found);
+	if (visited.size() < graph.num_vertices()) {
+		visited.resize(graph.num_vertices(), 0);
+	}
+	if (++stamp == 0) {
+		// stamp wrapped around, start over
+		std::fill(visited.begin(), visited.end(), 0);
+		stamp = 1;
 	}
 
-	// for each of its predecessors, recurse
-	TraceGraph_in_edge_iterator ii, ie;
-	for (boost::tie(ii, ie) = boost::in_edges(v, *graph); ii != ie; ii++) {
-		TraceGraph_vertex_descriptor parent = boost::source(*ii, *graph);
-		recursively_remove_redundant_dynamic_dependencies(graph, dynamicDeps, search, parent);
+	std::sort(deps.begin(), deps.end(), std::greater<TraceGraph_vertex_descriptor>());
+	deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+	TraceGraph_vertex_descriptor oldest = deps.back();
+
+	// number of dependences that are neither kept nor marked yet
+	unsigned unresolved = deps.size();
+	auto keep = deps.begin();
+	for (auto it = deps.begin(); it != deps.end(); it++) {
+		TraceGraph_vertex_descriptor d = *it;
+		if (visited[d] == stamp) {
+			// ancestor of a later dependence
+			shortcuts.push_back(d);
+			continue;
+		}
+		*keep++ = d;
+		visited[d] = stamp;
+		unresolved--;
+
+		// mark the ancestors of d that are not older than the oldest
+		// dependence, until every dependence is resolved
+		auto mark = [&](TraceGraph_vertex_descriptor ancestor) {
+			if (ancestor < oldest || visited[ancestor] == stamp) {
+				return;
+			}
+			visited[ancestor] = stamp;
+			// the dependences still to be examined are sorted from it on
+			if (std::binary_search(it, deps.end(), ancestor, std::greater<TraceGraph_vertex_descriptor>())) {
+				unresolved--;
+			}
+			worklist.push_back(ancestor);
+		};
+		worklist.clear();
+		worklist.push_back(d);
+		while (unresolved > 0 && !worklist.empty()) {
+			TraceGraph_vertex_descriptor v = worklist.back();
+			worklist.pop_back();
+			for (TraceGraph_edge_descriptor e = graph.in_begin(v); e != graph.in_end(v); e++) {
+				mark(graph.source(e));
+			}
+			// the shortcuts are pushed last so that they are followed first
+			for (unsigned i = shortcutOffset[v]; i < shortcutOffset[v + 1]; i++) {
+				mark(shortcuts[i]);
+			}
+		}
 	}
+	deps.erase(keep, deps.end());
 }
 
 #if 0
@@ -1077,11 +2353,10 @@ bool AdvisorAnalysis::find_maximal_configuration_for_call(Function *F, TraceGrap
 
 
 // Function: initialize_basic_block_instance_count
-// Initializes the replication factor metadata for each basic block in function to zero
+// Initializes the replication factor for each basic block in function to zero
 void AdvisorAnalysis::initialize_basic_block_instance_count(Function *F) {
-	for (auto BB = F->begin(); BB != F->end(); BB++) {
-		set_basic_block_instance_count(BB, 0);
-	}
+	FunctionInfo *FI = functionMap[F];
+	FI->repFactor.assign(FI->bbList.size(), 0);
 }
 
 #if 0
@@ -1401,8 +2676,8 @@ void AdvisorAnalysis::find_new_parents(std::vector<TraceGraph_vertex_descriptor>
 	}
 
 	// find the corresponding vertices on the DG
-	BasicBlock *childBB = graph[child].basicblock;
-	BasicBlock *parentBB = graph[parent].basicblock;
+	BasicBlock *childBB = graph.get_basic_block(child);
+	BasicBlock *parentBB = graph.get_basic_block(parent);
 
 	*outputLog << "Tracing through the execution graph -- child: " << childBB->getName() 
 				<< " parent: " << parentBB->getName() << "\n";
@@ -1425,9 +2700,8 @@ void AdvisorAnalysis::find_new_parents(std::vector<TraceGraph_vertex_descriptor>
 		}
 		return;
 	} else {
-		TraceGraph_in_edge_iterator ii, ie;
-		for (boost::tie(ii, ie) = boost::in_edges(parent, graph); ii != ie; ii++) {
-			TraceGraph_vertex_descriptor grandparent = boost::source(*ii, graph);
+		for (TraceGraph_edge_descriptor e = graph.in_begin(parent); e != graph.in_end(parent); e++) {
+			TraceGraph_vertex_descriptor grandparent = graph.source(e);
 			find_new_parents(newParents, child, grandparent, graph);
 		}
 	}
@@ -1459,14 +2733,12 @@ bool AdvisorAnalysis::annotate_schedule_for_call(Function *F, TraceGraphList_ite
 		boost::depth_first_search(*graph, boost::visitor(vis).root_vertex(*rV));
 	}*/
 
-	// use depth first visit to discover all the vertices in the graph
-	// do not need to give the root node of each disconnected subgraph
-	// use dfs instead of bfs because bfs only traverses nodes through a graph
-	// that is *reachable* from a starting node
-	// also, since there are no resource constraints, each basic block
-	// will be scheduled as early as possible, so no need for bfs here
-	ScheduleVisitor vis(graph, *LT, lastCycle);
-	boost::depth_first_search(*graph, boost::visitor(vis));
+	// since there are no resource constraints, each basic block
+	// will be scheduled as early as possible
+	ListScheduler scheduler;
+	scheduler.initialize(&functionMap[F]->latency);
+	// keep track of the last cycle as seen by the scheduler
+	lastCycle = std::max(lastCycle, scheduler.schedule(*graph, NULL));
 
 
 	// for printing labels in graph output
@@ -1480,10 +2752,10 @@ bool AdvisorAnalysis::annotate_schedule_for_call(Function *F, TraceGraphList_ite
 		dpTG.property("end", get(&BBSchedElem::minCycEnd, *graph));
 		boost::write_graphviz_dp(std::cerr, *graph, dpTG, std::string("id"));
 		*/
-		TraceGraphVertexWriter<TraceGraph> vpw(*graph);
-		TraceGraphEdgeWriter<TraceGraph> epw(*graph);
+		TraceGraphVertexWriter vpw(*graph, functionMap[F]->repFactor);
+		TraceGraphEdgeWriter epw(*graph);
 		std::ofstream outfile("maximal_schedule.dot");
-		boost::write_graphviz(outfile, *graph, vpw, epw);
+		write_trace_graph_graphviz(outfile, *graph, vpw, epw);
 	}
 
 	return true;
@@ -1503,6 +2775,8 @@ bool AdvisorAnalysis::find_maximal_resource_requirement(Function *F, TraceGraphL
 	// at first, the active blocks are the roots (which start execution at cycle 0)
 	std::vector<TraceGraph_vertex_descriptor> antichain = rootVertices;
 
+	FunctionInfo *FI = functionMap[F];
+
 	// keep track of timestamp
 	for (int timestamp = 0; timestamp < lastCycle; timestamp++) {
 		*outputLog << "Examine Cycle: " << timestamp << "\n";
@@ -1511,57 +2785,24 @@ bool AdvisorAnalysis::find_maximal_resource_requirement(Function *F, TraceGraphL
 		// basic block resource that is needed to execute all
 		// the basic blocks within the anti-chain for each given
 		// cycle
-		// it stores a pair of basic block ptr and an int representing
+		// it stores a pair of basic block index and an int representing
 		// the number of that basic block needed
-		std::map<BasicBlock *, int> activeBBs;
+		std::map<unsigned, int> activeBBs;
 		activeBBs.clear();
 
 		*outputLog << "anti-chain in cycle " << timestamp << ":\n";
-		// look at all active basic blocks and annotate the IR
-		// annotate annotate annotate
+		// look at all active basic blocks
 		for (auto it = antichain.begin(); it != antichain.end(); it++) {
-			BasicBlock *BB = (*graph)[*it].basicblock;
-			auto search = activeBBs.find(BB);
-			if (search != activeBBs.end()) {
-				// BB exists in activeBBs, increment count
-				search->second++;
-			} else {
-				// else add it to activeBBs list
-				activeBBs.insert(std::make_pair(BB, 1));
-			}
-			*outputLog << BB->getName() << "\n";
+			activeBBs[graph->get_block_index(*it)]++;
+			*outputLog << graph->get_basic_block(*it)->getName() << "\n";
 		}
 
 		*outputLog << "activeBBs:\n";
-		// update the IR
-		// will store the replication factor of each basic block as metadata
-		// could not find a way to directly attach metadata to each basic block
-		// will instead attach to the terminator instruction of each basic block
-		// this will be an issue if the basic block is merged/split...
+		// the replication factor of each basic block is the maximum
+		// number of concurrently active instances seen in any cycle
 		for (auto it = activeBBs.begin(); it != activeBBs.end(); it++) {
-			*outputLog << it->first->getName() << " repfactor " << it->second << "\n";
-			Instruction *inst = dyn_cast<Instruction>(it->first->getTerminator());
-			// look at pre-existing replication factor
-			LLVMContext &C = inst->getContext();
-			//MDNode *N = MDNode::get(C, MDString::get(C, "FPGA_ADVISOR_REPLICATION_FACTOR"));
-			// inst->setMetadata(repFactorStr, N);
-			int repFactor = 0; // zero indicates CPU execution
-
-			std::string MDName = "FPGA_ADVISOR_REPLICATION_FACTOR_";
-			MDName += inst->getParent()->getName().str();
-			MDNode *M = inst->getMetadata(MDName);
-
-			if (M && M->getOperand(0)) {
-				std::string repFactorStr = cast<MDString>(M->getOperand(0))->getString().str();
-				repFactor = stoi(repFactorStr);
-			} // else metadata was not set, repFactor is 0
-
-			repFactor = std::max(repFactor, it->second);
-			std::string repFactorStr = std::to_string(repFactor);
-
-			MDNode *N = MDNode::get(C, MDString::get(C, repFactorStr));
-
-			inst->setMetadata(MDName, N);
+			*outputLog << FI->bbList[it->first]->getName() << " repfactor " << it->second << "\n";
+			FI->repFactor[it->first] = std::max(FI->repFactor[it->first], it->second);
 		}
 
 		*outputLog << ".\n";
@@ -1597,15 +2838,15 @@ bool AdvisorAnalysis::find_maximal_resource_requirement(Function *F, TraceGraphL
 		std::vector<TraceGraph_vertex_descriptor> newantichain;
 		newantichain.clear();
 		for (auto it = antichain.begin(); it != antichain.end(); ) {
-			*outputLog << *it << " s: " << (*graph)[*it].cycStart << " e: " << (*graph)[*it].cycEnd << "\n";
-			if ((*graph)[*it].cycEnd == timestamp) {
+			*outputLog << *it << " s: " << graph->cycStart[*it] << " e: " << graph->cycEnd[*it] << "\n";
+			if (graph->cycEnd[*it] == timestamp) {
 				// keep track of the children to add
-				TraceGraph_out_edge_iterator oi, oe;
-				for (boost::tie(oi, oe) = boost::out_edges(*it, *graph); oi != oe; oi++) {
+				for (unsigned i = graph->out_begin(*it); i != graph->out_end(*it); i++) {
+					TraceGraph_vertex_descriptor child = graph->target(i);
 					// designate the latest finishing parent to add child to antichain
-					if (latest_parent(oi, graph)) {
-						*outputLog << "new elements to add " << boost::target(*oi, *graph);
-						newantichain.push_back(boost::target(*oi, *graph));
+					if (latest_parent(*it, child, graph)) {
+						*outputLog << "new elements to add " << child;
+						newantichain.push_back(child);
 					}
 				}
 				*outputLog << "erasing from antichain " << *it << "\n";
@@ -1622,24 +2863,30 @@ bool AdvisorAnalysis::find_maximal_resource_requirement(Function *F, TraceGraphL
 
 		*outputLog << "-\n";
 
+		// the antichain does not change until the next block ends, skip
+		// the cycles in between (folded loops leave long gaps)
+		int nextEnd = lastCycle - 1;
+		for (auto it = antichain.begin(); it != antichain.end(); it++) {
+			if (graph->cycEnd[*it] > timestamp) {
+				nextEnd = std::min(nextEnd, graph->cycEnd[*it]);
+			}
+		}
+		timestamp = std::max(timestamp, nextEnd - 1);
 	}
 	return true;
 }
 
-// return true if this edge connects the latest finishing parent to the child
-bool AdvisorAnalysis::latest_parent(TraceGraph_out_edge_iterator edge, TraceGraphList_iterator graph) {
-	TraceGraph_vertex_descriptor thisParent = boost::source(*edge, *graph);
-	TraceGraph_vertex_descriptor child = boost::target(*edge, *graph);
-	TraceGraph_in_edge_iterator ii, ie;
-	for (boost::tie(ii, ie) = boost::in_edges(child, *graph); ii != ie; ii++) {
-		TraceGraph_vertex_descriptor otherParent = boost::source(*ii, *graph);
+// return true if thisParent is the latest finishing parent of the child
+bool AdvisorAnalysis::latest_parent(TraceGraph_vertex_descriptor thisParent, TraceGraph_vertex_descriptor child, TraceGraphList_iterator graph) {
+	for (TraceGraph_edge_descriptor e = graph->in_begin(child); e != graph->in_end(child); e++) {
+		TraceGraph_vertex_descriptor otherParent = graph->source(e);
 		if (otherParent == thisParent) {
 			continue;
 		}
 		// designate to latest parent and also to parent whose vertex id is larger
-		if ( (*graph)[thisParent].cycEnd < (*graph)[otherParent].cycEnd ) {
+		if ( graph->cycEnd[thisParent] < graph->cycEnd[otherParent] ) {
 			return false;
-		} else if ( ((*graph)[thisParent].cycEnd == (*graph)[otherParent].cycEnd) && thisParent < otherParent ) {
+		} else if ( (graph->cycEnd[thisParent] == graph->cycEnd[otherParent]) && thisParent < otherParent ) {
 			return false;
 		}
 	}
@@ -1683,13 +2930,18 @@ void AdvisorAnalysis::find_optimal_configuration_for_all_calls(Function *F) {
 		ConvergenceCounter++; // for stats
 		std::cerr << "="; // progress bar
 
-		// BOOKMARK -- infinite loop situation here...
 		area = get_area_requirement(F);
 		if (area > areaConstraint) {
 			*outputLog << "Area constraint violated. Reduce area.\n";
 			BasicBlock *removeBB;
 			int deltaDelay = INT_MAX;
 			incremental_gradient_descent(F, removeBB, deltaDelay);
+			// none of the remaining blocks takes any area, the area
+			// cannot be reduced further
+			if (removeBB == NULL) {
+				*outputLog << "No basic block left to remove.\n";
+				break;
+			}
 			decrement_basic_block_instance_count(removeBB);
 
 			// printout
@@ -1702,7 +2954,9 @@ void AdvisorAnalysis::find_optimal_configuration_for_all_calls(Function *F) {
 			incremental_gradient_descent(F, removeBB, deltaDelay);
 
 			// only remove block if it doesn't negatively impact delay
-			if (deltaDelay >= 0) {
+			if (removeBB == NULL) {
+				deltaDelay = -1;
+			} else if (deltaDelay >= 0) {
 				decrement_basic_block_instance_count(removeBB);
 			}
 
@@ -1720,13 +2974,22 @@ void AdvisorAnalysis::find_optimal_configuration_for_all_calls(Function *F) {
 
 	// print out final scheduling results and area
 	unsigned finalLatency = 0;
-	for (TraceGraphList_iterator fIt = executionGraph[F].begin();
-		fIt != executionGraph[F].end(); fIt++) {
-		std::vector<TraceGraph_vertex_descriptor> roots;
-		roots.clear();
-		find_root_vertices(roots, fIt);
-		finalLatency += schedule_with_resource_constraints(roots, fIt, F);
+	unsigned calls = 0;
+	if (StreamTrace && ! streamSummary.complete) {
+		streamSummary.latency = 0;
+		stream_program_trace(F, &AdvisorAnalysis::summarize_final_configuration_for_call);
+		finalLatency = streamSummary.latency;
+		calls = streamSummary.calls;
+	} else {
+		for (TraceGraphList_iterator fIt = executionGraph[F].begin();
+			fIt != executionGraph[F].end(); fIt++) {
+			// the latency is inherited by the callers of this call
+			fIt->set_call_latency(schedule_with_resource_constraints(fIt, F, NULL));
+			finalLatency += fIt->get_call_latency() * fIt->get_multiplicity();
+			calls += fIt->get_multiplicity();
+		}
 	}
+	functionMap[F]->callLatency = (calls > 0) ? finalLatency / calls : 0;
 	
 	unsigned finalArea = get_area_requirement(F);
 
@@ -1740,17 +3003,46 @@ void AdvisorAnalysis::find_optimal_configuration_for_all_calls(Function *F) {
 // Function will iterate through each basic block which has a hardware instance of more than 0
 // to determine the change in delay with the removal of that basic block and finds the basic block
 // whose contribution of delay/area is the least (closest to zero or negative)
+// removeBB is NULL if none of the basic blocks with an instance takes any area
 void AdvisorAnalysis::incremental_gradient_descent(Function *F, BasicBlock *&removeBB, int &deltaDelay) {
+	removeBB = NULL;
 	unsigned initialArea = get_area_requirement(F);
 	*outputLog << "Initial area: " << initialArea << "\n";
+
+	FunctionInfo *FI = functionMap[F];
+
+	// the candidates are the basic blocks that have an instance to remove
+	std::vector<unsigned> candidates;
+	for (unsigned i = 0; i < FI->bbList.size(); i++) {
+		if (FI->repFactor[i] > 0) {
+			candidates.push_back(i);
+		}
+	}
+
 	unsigned initialLatency = 0;
-	// need to loop through all calls to function to get total latency
-	for (TraceGraphList_iterator fIt = executionGraph[F].begin();
-		fIt != executionGraph[F].end(); fIt++) {
-		std::vector<TraceGraph_vertex_descriptor> roots;
-		roots.clear();
-		find_root_vertices(roots, fIt);
-		initialLatency += schedule_with_resource_constraints(roots, fIt, F);
+	std::vector<unsigned> candidateLatency(candidates.size());
+	if (StreamTrace && ! streamSummary.complete) {
+		// each call is evaluated for all candidates as it is read, only the
+		// summed latencies are kept
+		streamSummary.latency = 0;
+		streamSummary.candidates = candidates;
+		streamSummary.candidateLatency.assign(candidates.size(), 0);
+		stream_program_trace(F, &AdvisorAnalysis::summarize_candidate_latencies_for_call);
+		initialLatency = streamSummary.latency;
+		candidateLatency = streamSummary.candidateLatency;
+	} else {
+		// need to loop through all calls to function to get total latency
+		// the schedule of each call is cached so that the candidate removals
+		// below only need to reschedule the calls that they affect
+		std::vector<TraceGraph *> graphs;
+		scheduleCache.resize(executionGraph[F].size());
+		auto cIt = scheduleCache.begin();
+		for (TraceGraphList_iterator fIt = executionGraph[F].begin();
+			fIt != executionGraph[F].end(); fIt++, cIt++) {
+			initialLatency += schedule_with_resource_constraints(fIt, F, &(*cIt)) * fIt->get_multiplicity();
+			graphs.push_back(&(*fIt));
+		}
+		evaluate_candidate_latencies(F, graphs, candidates, candidateLatency);
 	}
 
 	// we set an initial min marginal performance as the average performance/area
@@ -1758,23 +3050,13 @@ void AdvisorAnalysis::incremental_gradient_descent(Function *F, BasicBlock *&rem
 	float minMarginalPerformance = FLT_MAX;
 
 	// try removing each basic block
-	for (auto BB = F->begin(); BB != F->end(); BB++) {
+	// the candidates are examined in basic block order so that the result
+	// does not depend on the order in which they were evaluated
+	for (unsigned c = 0; c < candidates.size(); c++) {
+		BasicBlock *BB = FI->bbList[candidates[c]];
 		if (decrement_basic_block_instance_count(BB)) {
 			*outputLog << "Performing removal of basic block " << BB->getName() << "\n";
-			// need to iterate through all calls made to function
-			unsigned latency = 0;
-			for (TraceGraphList_iterator fIt = executionGraph[F].begin();
-				fIt != executionGraph[F].end(); fIt++) {
-				std::vector<TraceGraph_vertex_descriptor> roots;
-				roots.clear();
-				find_root_vertices(roots, fIt);
-
-				// need to update edge weights before scheduling in case any blocks
-				// become implemented on cpu
-				update_transition_delay(fIt);
-
-				latency += schedule_with_resource_constraints(roots, fIt, F);
-			}
+			unsigned latency = candidateLatency[c];
 
 			*outputLog << "New latency: " << latency << "\n";
 
@@ -1930,48 +3212,510 @@ int AdvisorAnalysis::incremental_gradient_descent(Function *F, BasicBlock *&remo
 // Function: schedule_with_resource_constraints
 // Return: latency of execution of trace
 // This function will use the execution trace graph generated previously 
-// and the resource constraints embedded in the IR as metadata to determine
+// and the replication factor of each basic block to determine
 // the latency of the particular function call instance represented by this
 // execution trace
-unsigned AdvisorAnalysis::schedule_with_resource_constraints(std::vector<TraceGraph_vertex_descriptor> &roots, TraceGraphList_iterator graph_it, Function *F) {
+// The schedule and the transition delays are recorded in the graph, if cache
+// is given, the snapshots needed to reschedule candidate configurations are
+// also recorded
+unsigned AdvisorAnalysis::schedule_with_resource_constraints(TraceGraphList_iterator graph_it, Function *F, ScheduleCache *cache) {
 	*outputLog << __func__ << "\n";
 
-	TraceGraph graph = *graph_it;
-	// perform the scheduling with resource considerations
-	
-	// use hash table to keep track of resources available
-	// the key is the basicblock resource	
-	// each key indexes into a vector of unsigned integers
-	// the number of elements in the vector correspond to the
-	// number of available resources of that basic block
-	// the vector contains unsigned ints which represent the cycle
-	// at which the resource next becomes available
-	// the bool of the pair in the value is the CPU resource flag
-	// if set to true, no additional hardware is required
-	// however, a global value is used to keep track of the cpu
-	// idleness
-	std::map<BasicBlock *, std::pair<bool, std::vector<unsigned> > > resourceTable;
-	resourceTable.clear();
-
-	//===----------------------------------------------------===//
-	// Populate resource table
-	//===----------------------------------------------------===//
-	initialize_resource_table(F, resourceTable);
-
-	// reset the cpu free cycle global!
-	cpuCycle = -1;
+	FunctionInfo *FI = functionMap[F];
+	constrainedScheduler.initialize(&FI->latency, &FI->repFactor);
+	return constrainedScheduler.schedule(*graph_it, cache);
+}
 
-	int lastCycle = -1;
 
-	//===----------------------------------------------------===//
-	// Use breadth first search to perform the scheduling
-	// with resource constraints
-	//===----------------------------------------------------===//
-	for (std::vector<TraceGraph_vertex_descriptor>::iterator rV = roots.begin();
-			rV != roots.end(); rV++) {
-		ConstrainedScheduleVisitor vis(graph, *LT/*latency of BBs*/, lastCycle, cpuCycle, resourceTable);
-		boost::breadth_first_search(graph, vertex(0, graph), boost::visitor(vis).root_vertex(*rV));
-		//boost::depth_first_search(graph, boost::visitor(vis).root_vertex(*rV));
+// Function: WorkerPool::~WorkerPool
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	started.notify_all();
+	for (auto it = threads.begin(); it != threads.end(); it++) {
+		it->join();
+	}
+}
+
+// Function: WorkerPool::run
+// Runs job on numThreads threads, the calling thread and numThreads - 1
+// threads of the pool, and returns once all of them have returned from job
+void WorkerPool::run(unsigned numThreads, const std::function<void()> &job) {
+	if (numThreads <= 1) {
+		job();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (threads.size() < numThreads - 1) {
+			threads.push_back(std::thread(&WorkerPool::work, this, (unsigned) threads.size()));
+		}
+		this->job = &job;
+		active = numThreads - 1;
+		running = active;
+		generation++;
+	}
+	started.notify_all();
+
+	job();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return running == 0; });
+}
+
+// Function: WorkerPool::work
+// Body of the index-th thread of the pool, takes part in each job that needs
+// more than index + 1 threads
+void WorkerPool::work(unsigned index) {
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		started.wait(lock, [&]() { return stopping || generation != seen; });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+		if (index >= active) {
+			continue;
+		}
+		lock.unlock();
+		(*job)();
+		lock.lock();
+		if (--running == 0) {
+			finished.notify_one();
+		}
+	}
+}
+
+
+// Function: evaluate_candidate_latencies
+// For each candidate basic block index, computes the total latency of the
+// calls in graphs with one instance of that basic block removed, given the
+// schedule cache of the current configuration (scheduleCache[i] for graphs[i]).
+// The latency of each graph is weighted by the number of calls it represents.
+// The candidates are independent of each other and are evaluated by a pool of
+// -fpga-advisor-threads threads of workerPool. Each thread works on its own copy of the
+// replication factors and its own scheduler, the trace graphs and the
+// schedule cache are only read.
+void AdvisorAnalysis::evaluate_candidate_latencies(Function *F, std::vector<TraceGraph *> &graphs, std::vector<unsigned> &candidates, std::vector<unsigned> &latencies) {
+	FunctionInfo *FI = functionMap[F];
+
+	// candidates are handed out one at a time
+	std::atomic<unsigned> nextCandidate(0);
+	auto worker = [&]() {
+		std::vector<int> repFactor = FI->repFactor;
+		ListScheduler scheduler;
+		scheduler.initialize(&FI->latency, &repFactor);
+		for (unsigned c = nextCandidate++; c < candidates.size(); c = nextCandidate++) {
+			unsigned blockIndex = candidates[c];
+			repFactor[blockIndex]--;
+			unsigned latency = 0;
+			for (unsigned i = 0; i < graphs.size(); i++) {
+				latency += scheduler.reschedule(*graphs[i], scheduleCache[i], blockIndex) * graphs[i]->get_multiplicity();
+			}
+			repFactor[blockIndex]++;
+			latencies[c] = latency;
+		}
+	};
+
+	workerPool.run(std::min(get_thread_count(), (unsigned) candidates.size()), worker);
+
+	if (VerifyReschedule) {
+		verify_candidate_latencies(F, graphs, candidates, latencies);
+	}
+}
+
+
+// Function: verify_candidate_latencies
+// Compares the latency of each candidate computed by
+// evaluate_candidate_latencies with a full schedule of the graphs with one
+// instance of the candidate removed, and reports the candidates that differ.
+// The graphs and their schedule cache are left as they were.
+void AdvisorAnalysis::verify_candidate_latencies(Function *F, std::vector<TraceGraph *> &graphs, std::vector<unsigned> &candidates, std::vector<unsigned> &latencies) {
+	FunctionInfo *FI = functionMap[F];
+	std::vector<int> repFactor = FI->repFactor;
+	ListScheduler scheduler;
+
+	for (unsigned c = 0; c < candidates.size(); c++) {
+		unsigned blockIndex = candidates[c];
+		repFactor[blockIndex]--;
+		scheduler.initialize(&FI->latency, &repFactor);
+		unsigned latency = 0;
+		for (unsigned i = 0; i < graphs.size(); i++) {
+			latency += scheduler.schedule(*graphs[i], NULL) * graphs[i]->get_multiplicity();
+		}
+		repFactor[blockIndex]++;
+		if (latency != latencies[c]) {
+			errs() << "Rescheduled latency " << latencies[c] << " without an instance of " << FI->bbList[blockIndex]->getName()
+					<< " in " << F->getName() << " differs from the full schedule latency " << latency << "!\n";
+		}
+	}
+
+	// restore the schedule of the current configuration
+	scheduler.initialize(&FI->latency, &FI->repFactor);
+	for (unsigned i = 0; i < graphs.size(); i++) {
+		scheduler.schedule(*graphs[i], &scheduleCache[i]);
+	}
+}
+
+
+// Function: summarize_candidate_latencies_for_call
+// Return: true if scheduled
+// Streamed counterpart of one gradient descent step for a single call:
+// schedules the call in the current configuration and reschedules it for each
+// candidate in streamSummary, adding the latencies to the summary
+bool AdvisorAnalysis::summarize_candidate_latencies_for_call(Function *F, TraceGraphList_iterator graph_it) {
+	scheduleCache.resize(1);
+	streamSummary.latency += schedule_with_resource_constraints(graph_it, F, &scheduleCache[0]) * graph_it->get_multiplicity();
+
+	// the latencies are weighted by evaluate_candidate_latencies
+	std::vector<TraceGraph *> graphs(1, &(*graph_it));
+	std::vector<unsigned> latencies(streamSummary.candidates.size());
+	evaluate_candidate_latencies(F, graphs, streamSummary.candidates, latencies);
+	for (unsigned c = 0; c < latencies.size(); c++) {
+		streamSummary.candidateLatency[c] += latencies[c];
+	}
+	return true;
+}
+
+
+// Function: summarize_final_configuration_for_call
+// Return: true if scheduled
+// Schedules a single call in the final configuration, adds its latency to
+// streamSummary and prints its graph unless graphs are hidden
+bool AdvisorAnalysis::summarize_final_configuration_for_call(Function *F, TraceGraphList_iterator graph_it) {
+	streamSummary.latency += schedule_with_resource_constraints(graph_it, F, NULL) * graph_it->get_multiplicity();
+
+	if (!HideGraph) {
+		std::string outfileName(F->getName().str() + "." + std::to_string(streamSummary.calls) + ".final.dot");
+		TraceGraphVertexWriter vpw(*graph_it, functionMap[F]->repFactor);
+		TraceGraphEdgeWriter epw(*graph_it);
+		std::ofstream outfile(outfileName);
+		write_trace_graph_graphviz(outfile, *graph_it, vpw, epw);
+	}
+	return true;
+}
+
+
+// Function: IndexedTraceWriter::IndexedTraceWriter
+IndexedTraceWriter::IndexedTraceWriter(raw_fd_ostream &_out) : out(_out) {}
+
+// Function: IndexedTraceWriter::enter_function
+// Starts a new call of the function
+void IndexedTraceWriter::enter_function(FunctionInfo *FI) {
+	openCalls[FI].push_back(IndexedTraceCall());
+	callStack.push_back(FI);
+}
+
+// Function: IndexedTraceWriter::add_basic_block
+// Appends a basic block execution to the current call of its function
+void IndexedTraceWriter::add_basic_block(FunctionInfo *FI, unsigned blockIndex) {
+	std::vector<IndexedTraceCall> &calls = openCalls[FI];
+	if (calls.empty()) {
+		// the trace started within the call
+		calls.push_back(IndexedTraceCall());
+	}
+	calls.back().blocks.push_back(blockIndex);
+}
+
+// Function: IndexedTraceWriter::add_memory_access
+// Adds a load or store to the current call of the innermost function on the
+// call stack
+void IndexedTraceWriter::add_memory_access(bool write, uint64_t address, unsigned size) {
+	if (callStack.empty()) {
+		return;
+	}
+	std::vector<IndexedTraceCall> &calls = openCalls[callStack.back()];
+	if (calls.empty()) {
+		return;
+	}
+	IndexedTraceCall &call = calls.back();
+	IndexedTraceAccess access = {(uint32_t) call.blocks.size(), write, size, address};
+	call.accesses.push_back(access);
+}
+
+// Function: IndexedTraceWriter::return_from_function
+// Writes the call record of the current call of the function and links it to
+// the current call of its caller
+void IndexedTraceWriter::return_from_function(FunctionInfo *FI) {
+	if (openCalls[FI].empty()) {
+		return;
+	}
+	FunctionInfo *caller = NULL;
+	if (! callStack.empty() && callStack.back() == FI) {
+		callStack.pop_back();
+		if (! callStack.empty()) {
+			caller = callStack.back();
+		}
+	}
+
+	uint64_t offset = write_call(FI);
+	if (caller && ! openCalls[caller].empty()) {
+		IndexedTraceCall &call = openCalls[caller].back();
+		call.callees.push_back(std::make_pair((uint32_t) call.blocks.size(), offset));
+	}
+}
+
+// Function: IndexedTraceWriter::write_call
+// Return: the offset of the call record
+// Writes the call record of the current call of the function
+uint64_t IndexedTraceWriter::write_call(FunctionInfo *FI) {
+	std::vector<IndexedTraceCall> &calls = openCalls[FI];
+	uint64_t offset = out.tell();
+	IndexedTraceEntry &entry = entries[FI];
+	entry.info = FI;
+	entry.calls.push_back(offset);
+
+	support::endian::Writer<support::little> LE(out);
+	IndexedTraceCall &call = calls.back();
+	LE.write<uint32_t>(call.blocks.size());
+	for (auto it = call.blocks.begin(); it != call.blocks.end(); it++) {
+		LE.write<uint32_t>(*it);
+	}
+	LE.write<uint32_t>(call.callees.size());
+	for (auto it = call.callees.begin(); it != call.callees.end(); it++) {
+		LE.write<uint32_t>(it->first);
+		LE.write<uint64_t>(it->second);
+	}
+	LE.write<uint32_t>(call.accesses.size());
+	for (auto it = call.accesses.begin(); it != call.accesses.end(); it++) {
+		LE.write<uint32_t>(it->position);
+		LE.write<uint32_t>(it->write ? FPGA_ADVISOR_TRACE_STORE : FPGA_ADVISOR_TRACE_LOAD);
+		LE.write<uint32_t>(it->size);
+		LE.write<uint64_t>(it->address);
+	}
+	calls.pop_back();
+	return offset;
+}
+
+// Function: IndexedTraceWriter::finish
+// Return: the offset of the index
+// Writes the calls that never returned and then the index. Like the calls that
+// never returned when the trace is read, they are not linked to their callers.
+uint64_t IndexedTraceWriter::finish() {
+	callStack.clear();
+	for (auto it = openCalls.begin(); it != openCalls.end(); it++) {
+		while (!it->second.empty()) {
+			write_call(it->first);
+		}
+	}
+
+	OnDiskChainedHashTableGenerator<IndexedTraceWriterTrait> generator;
+	for (auto it = entries.begin(); it != entries.end(); it++) {
+		generator.insert(it->first->function->getName(), &it->second);
+	}
+	return generator.Emit(out);
+}
+
+
+// Function: ListScheduler::schedule
+// Return: latency of execution of trace
+int ListScheduler::schedule(TraceGraph &graph, ScheduleCache *cache) {
+	if (!repFactor) {
+		// unconstrained
+		int lastCycle = schedule_vertices(graph, 0, -1, graph.minCycStart.data(), graph.minCycEnd.data(), true, NULL);
+		graph.cycStart = graph.minCycStart;
+		graph.cycEnd = graph.minCycEnd;
+		return lastCycle;
+	}
+
+	resources.initialize(*repFactor);
+	if (cache) {
+		cache->snapshotIndex.assign(repFactor->size(), -1);
+		cache->snapshots.clear();
+		occupied.assign(repFactor->size(), false);
+		occupiedBlocks.clear();
+	}
+
+	int lastCycle = schedule_vertices(graph, 0, -1, graph.cycStart.data(), graph.cycEnd.data(), true, cache);
+
+	if (cache) {
+		cache->latency = lastCycle;
+	}
+	return lastCycle;
+}
+
+
+// Function: ListScheduler::reschedule
+// Return: latency of execution of trace
+// The vertices executed before the first execution of the basic block are not
+// affected, scheduling restarts from the snapshot taken before that vertex.
+int ListScheduler::reschedule(TraceGraph &graph, ScheduleCache &cache, unsigned blockIndex) {
+	assert(repFactor);
+	int snapshotIndex = cache.snapshotIndex[blockIndex];
+	if (snapshotIndex < 0) {
+		// the basic block is not executed in hardware in this call
+		return cache.latency;
+	}
+
+	ScheduleSnapshot &snapshot = cache.snapshots[snapshotIndex];
+
+	// restore the resources from the snapshot, the instances of the basic
+	// block have not been used yet so they are all still free, the layout is
+	// kept and only the instance count of the basic block changes
+	restore_snapshot(cache, snapshotIndex);
+	resources.count[blockIndex] = std::max((*repFactor)[blockIndex], 0);
+
+	unsigned numVertices = graph.num_vertices() - snapshot.vertex;
+	scratchStart.resize(numVertices);
+	scratchEnd.resize(numVertices);
+	int lastCycle = schedule_vertices(graph, snapshot.vertex, snapshot.lastCycle, scratchStart.data(), scratchEnd.data(), false, NULL);
+
+	// leave the resource layout consistent with the cached configuration
+	resources.count[blockIndex] = resources.offset[blockIndex + 1] - resources.offset[blockIndex];
+
+	return lastCycle;
+}
+
+
+// Function: ListScheduler::restore_snapshot
+// Restores the resources as they were when snapshot snapshotIndex was taken.
+// The snapshot before the first execution of each hardware basic block only
+// keeps the instances occupied since the previous snapshot, so the latest copy
+// of each basic block is found by going back through the earlier snapshots.
+// The snapshotIndex basic blocks executed in hardware before the snapshot all
+// have a copy, the instances of the other basic blocks are still unused.
+void ListScheduler::restore_snapshot(ScheduleCache &cache, unsigned snapshotIndex) {
+	std::fill(resources.free.begin(), resources.free.end(), 0);
+	restored.assign(resources.count.size(), false);
+	unsigned pending = snapshotIndex;
+	for (int i = snapshotIndex; i >= 0 && pending > 0; i--) {
+		ScheduleSnapshot &snapshot = cache.snapshots[i];
+		auto slice = snapshot.free.begin();
+		for (auto b = snapshot.blocks.begin(); b != snapshot.blocks.end(); b++) {
+			unsigned size = resources.offset[*b + 1] - resources.offset[*b];
+			if (!restored[*b]) {
+				restored[*b] = true;
+				pending--;
+				std::copy(slice, slice + size, resources.free.begin() + resources.offset[*b]);
+			}
+			slice += size;
+		}
+	}
+	resources.cpuCycle = cache.snapshots[snapshotIndex].cpuCycle;
+}
+
+
+// Function: ListScheduler::schedule_vertices
+// Return: the last cycle of the schedule
+// Schedules the vertices [first, num_vertices) in order, the schedule of
+// vertex v is written to start[v - first] and end[v - first], the end cycles
+// of vertices before first are taken from the schedule recorded in the graph.
+// If update is set the transition delays are recorded in the graph.
+// The last kept iteration of a folded loop run starts the folded iterations
+// later than it would otherwise, at the average initiation interval of the
+// kept iterations before it (loop carried dependences at a distance above 1
+// let several iterations start together).
+// An edge with a ready offset only waits for that many cycles of its source,
+// unless the source makes calls, whose latency is only known for the whole
+// basic block.
+int ListScheduler::schedule_vertices(TraceGraph &graph, TraceGraph_vertex_descriptor first, int lastCycle, int *start, int *end, bool update, ScheduleCache *cache) {
+	const std::vector<TraceLoopFold> &folds = graph.get_loop_folds();
+	auto fold = folds.begin();
+	while (fold != folds.end() && fold->begin + fold->length <= first) {
+		fold++;
+	}
+	int shift = 0;
+
+	for (TraceGraph_vertex_descriptor v = first; v < graph.num_vertices(); v++) {
+		// the end of the last vertex of each kept iteration gives the
+		// initiation interval, at least 3 iterations are kept
+		bool folded = (fold != folds.end() && v >= fold->begin);
+		if (folded && v == std::max(fold->begin, first)) {
+			TraceGraph_vertex_descriptor u = fold->begin - 1;
+			TraceGraph_vertex_descriptor w = u - (fold->kept - 2) * fold->length;
+			int interval = ((u < first) ? graph.cycEnd[u] : end[u - first]) - ((w < first) ? graph.cycEnd[w] : end[w - first]);
+			shift = (int) (fold->folded * std::max(interval, 0) / (fold->kept - 2));
+		}
+
+		unsigned blockIndex = graph.get_block_index(v);
+		bool cpu = repFactor && resources.is_cpu(blockIndex);
+
+		// save the scheduler state before the first execution of each
+		// basic block that uses hardware resources
+		if (cache && !cpu && cache->snapshotIndex[blockIndex] < 0) {
+			cache->snapshotIndex[blockIndex] = cache->snapshots.size();
+			cache->snapshots.push_back(ScheduleSnapshot());
+			ScheduleSnapshot &snapshot = cache->snapshots.back();
+			snapshot.vertex = v;
+			snapshot.lastCycle = lastCycle;
+			snapshot.cpuCycle = resources.cpuCycle;
+			for (auto b = occupiedBlocks.begin(); b != occupiedBlocks.end(); b++) {
+				snapshot.blocks.push_back(*b);
+				snapshot.free.insert(snapshot.free.end(), resources.free.begin() + resources.offset[*b], resources.free.begin() + resources.offset[*b + 1]);
+				occupied[*b] = false;
+			}
+			occupiedBlocks.clear();
+		}
+
+		// find the latest finishing parent
+		// if no parent, start at 0
+		int ready = -1;
+		for (TraceGraph_edge_descriptor e = graph.in_begin(v); e != graph.in_end(v); e++) {
+			TraceGraph_vertex_descriptor s = graph.source(e);
+			int parentEnd = (s < first) ? graph.cycEnd[s] : end[s - first];
+			int offset = graph.get_ready_offset(e);
+			if (offset >= 0 && graph.get_callee_latency(s) == 0) {
+				int parentStart = (s < first) ? graph.cycStart[s] : start[s - first];
+				parentEnd = std::min(parentEnd, parentStart + offset);
+			}
+			if (folded && s < fold->begin) {
+				parentEnd += shift;
+			}
+			// add edge weight <=> transition delay when crossing a hw/cpu boundary
+			unsigned transitionDelay = 0;
+			if (repFactor) {
+				bool sHwExec = (0 < (*repFactor)[graph.get_block_index(s)]);
+				bool tHwExec = !cpu;
+				if (sHwExec ^ tHwExec) {
+					// CPUToHW if the target executes on fpga
+					transitionDelay = AdvisorAnalysis::get_transition_delay(graph.get_basic_block(s), graph.get_basic_block(v), tHwExec);
+				}
+				if (update) {
+					graph.set_delay(e, transitionDelay);
+				}
+			}
+			ready = std::max(ready, parentEnd + (int) transitionDelay);
+		}
+		ready += 1;
+
+		// this differs from the maximal parallelism configuration scheduling
+		// in that it also considers resource requirement
+		if (repFactor) {
+			if (cpu) { // cpu resource flag
+				ready = std::max(ready, resources.cpuCycle);
+			} else {
+				ready = std::max(ready, resources.earliest_available(blockIndex));
+			}
+		}
+
+		// a vertex that makes calls also waits for its callees
+		int finish = ready + (*latency)[blockIndex] + graph.get_callee_latency(v);
+
+		// update the occupied resource with the new end cycle
+		if (repFactor) {
+			if (cpu) {
+				resources.cpuCycle = finish;
+			} else {
+				resources.occupy(blockIndex, finish);
+				if (cache && !occupied[blockIndex]) {
+					occupied[blockIndex] = true;
+					occupiedBlocks.push_back(blockIndex);
+				}
+			}
+		}
+
+		start[v - first] = ready;
+		end[v - first] = finish;
+
+		// keep track of last cycle as seen by scheduler
+		lastCycle = std::max(lastCycle, finish);
+
+		if (folded && v == fold->begin + fold->length - 1) {
+			fold++;
+		}
 	}
 
 	return lastCycle;
@@ -1981,119 +3725,66 @@ unsigned AdvisorAnalysis::schedule_with_resource_constraints(std::vector<TraceGr
 // Function: find_root_vertices
 // Finds all vertices with in degree 0 -- root of subgraph/tree
 void AdvisorAnalysis::find_root_vertices(std::vector<TraceGraph_vertex_descriptor> &roots, TraceGraphList_iterator graph_it) {
-	TraceGraph graph = *graph_it;
-	TraceGraph_iterator vi, ve;
-	for (boost::tie(vi, ve) = vertices(graph); vi != ve; vi++) {
-		if (boost::in_degree(*vi, graph) == 0) {
-			roots.push_back(*vi);
+	TraceGraph &graph = *graph_it;
+	for (TraceGraph_vertex_descriptor v = 0; v < graph.num_vertices(); v++) {
+		if (graph.in_degree(v) == 0) {
+			roots.push_back(v);
 		}
 	}
 }
 
 // Function: set_basic_block_instance_count
-// Set the basic block metadata to denote the number of basic block instances
-// needed
+// Set the number of basic block instances needed
 void AdvisorAnalysis::set_basic_block_instance_count(BasicBlock *BB, int value) {
-	std::string MDName = "FPGA_ADVISOR_REPLICATION_FACTOR_";
-	MDName += BB->getName().str();
-	LLVMContext &C = BB->getContext();
-	MDNode *N = MDNode::get(C, MDString::get(C, std::to_string(value)));
-	BB->getTerminator()->setMetadata(MDName, N);
+	FunctionInfo *FI = functionMap[BB->getParent()];
+	FI->repFactor[FI->bbIndex[BB]] = value;
 }
 
 // Function: decrement_basic_block_instance_count
 // Return: false if decrement not successful
-// Modify basic block metadata to denote the number of basic block instances
-// needed
+// Decrements the number of basic block instances needed
 bool AdvisorAnalysis::decrement_basic_block_instance_count(BasicBlock *BB) {
 	int repFactor = get_basic_block_instance_count(BB);
 	if (repFactor <= 0) { // 0 represents CPU execution, anything above 0 means HW accel
 		return false;
 	}
 
-	/*
-	std::string MDName = "FPGA_ADVISOR_REPLICATION_FACTOR_";
-	MDName += BB->getName().str();
-	LLVMContext &C = BB->getContext();
-	MDNode *N = MDNode::get(C, MDString::get(C, std::to_string(repFactor-1)));
-	BB->getTerminator()->setMetadata(MDName, N);
-	*/
 	set_basic_block_instance_count(BB, repFactor - 1);
 	return true;
 }
 
 // Function: increment_basic_block_instance_count
 // Return: false if decrement not successful
-// Modify basic block metadata to denote the number of basic block instances
-// needed
+// Increments the number of basic block instances needed
 bool AdvisorAnalysis::increment_basic_block_instance_count(BasicBlock *BB) {
 	int repFactor = get_basic_block_instance_count(BB);
 
-	/*
-	std::string MDName = "FPGA_ADVISOR_REPLICATION_FACTOR_";
-	MDName += BB->getName().str();
-	LLVMContext &C = BB->getContext();
-	MDNode *N = MDNode::get(C, MDString::get(C, std::to_string(repFactor+1)));
-	BB->getTerminator()->setMetadata(MDName, N);
-	*/
 	set_basic_block_instance_count(BB, repFactor + 1);
 
 	return true;
 }
 
 // Function: get_basic_block_instance_count
-// Return: the number of instances of this basic block from metadata
+// Return: the number of instances of this basic block
 int AdvisorAnalysis::get_basic_block_instance_count(BasicBlock *BB) {
 	assert(BB);
-	std::string MDName = "FPGA_ADVISOR_REPLICATION_FACTOR_";
-	MDName += BB->getName().str();
-	MDNode *M = BB->getTerminator()->getMetadata(MDName);
-
-	int repFactor = -1;
-
-	assert(M);
-	assert(M->getOperand(0));
-
-	std::string repFactorStr = cast<MDString>(M->getOperand(0))->getString().str();
-	repFactor = stoi(repFactorStr);
-
-	//*outputLog << __func__ << " metadata: ";
-	//BB->getTerminator()->print(*outputLog);
-	//*outputLog << " replication factor: " << repFactor << "\n";
-
-	return repFactor;
+	FunctionInfo *FI = functionMap[BB->getParent()];
+	assert(FI->repFactor.size() == FI->bbList.size());
+	return FI->repFactor[FI->bbIndex[BB]];
 }
 
-
-// Function: initialize_resource_table
-// The resource table represents the resources needed for this program
-// the resources we need to consider are:
-// HW logic: represented by individual basic blocks
-// CPU: represented by a flag
-// other??
-// FIXME: integrate the cpu
-void AdvisorAnalysis::initialize_resource_table(Function *F, std::map<BasicBlock *, std::pair<bool, std::vector<unsigned> > > &resourceTable) {
-	for (auto BB = F->begin(); BB != F->end(); BB++) {
-		int repFactor = get_basic_block_instance_count(BB);
-		if (repFactor < 0) {
-			continue;
-		}
-
-		if (repFactor == 0) {
-			// cpu
-			std::vector<unsigned> resourceVector(0);
-			resourceTable.insert(std::make_pair(BB, std::make_pair(true, resourceVector)));
-			*outputLog << "Created entry in resource table for basic block: " << BB->getName()
-						<< " using cpu resources.\n";
-		} else {
-			// fpga
-			// create a vector
-			std::vector<unsigned> resourceVector(repFactor, 0);
-			resourceTable.insert(std::make_pair(BB, std::make_pair(false, resourceVector)));
-
-			*outputLog << "Created entry in resource table for basic block: " << BB->getName()
-						<< " with " << repFactor << " entries.\n";
-		}
+// Function: annotate_basic_block_instance_count
+// Writes the replication factor of each basic block of F to the IR
+// could not find a way to directly attach metadata to each basic block
+// will instead attach to the terminator instruction of each basic block
+// this will be an issue if the basic block is merged/split...
+void AdvisorAnalysis::annotate_basic_block_instance_count(Function *F) {
+	FunctionInfo *FI = functionMap[F];
+	LLVMContext &C = F->getContext();
+	unsigned MDKind = C.getMDKindID("FPGA_ADVISOR_REPLICATION_FACTOR");
+	for (unsigned i = 0; i < FI->bbList.size(); i++) {
+		MDNode *N = MDNode::get(C, MDString::get(C, std::to_string(FI->repFactor[i])));
+		FI->bbList[i]->getTerminator()->setMetadata(MDKind, N);
 	}
 }
 
@@ -2105,42 +3796,15 @@ unsigned AdvisorAnalysis::get_area_requirement(Function *F) {
 	// baseline area required for cpu
 	//int area = 1000;
 	int area = 0;
-	for (auto BB = F->begin(); BB != F->end(); BB++) {
-		int areaBB = FunctionAreaEstimator::get_basic_block_area(*AT, BB);
-		int repFactor = get_basic_block_instance_count(BB);
-		area += areaBB * repFactor;
+	FunctionInfo *FI = functionMap[F];
+	for (unsigned i = 0; i < FI->bbList.size(); i++) {
+		int areaBB = FunctionAreaEstimator::get_basic_block_area(FI->areaTable, FI->bbList[i]);
+		area += areaBB * FI->repFactor[i];
 	}
 	return area;
 }
 
 
-// Function: update_transition_delay
-// updates the trace execution graph edge weights
-void AdvisorAnalysis::update_transition_delay(TraceGraphList_iterator graph) {
-	TraceGraph_edge_iterator ei, ee;
-	for (boost::tie(ei, ee) = edges(*graph); ei != ee; ei++) {
-		TraceGraph_vertex_descriptor s = boost::source(*ei, *graph);
-		TraceGraph_vertex_descriptor t = boost::target(*ei, *graph);
-		bool sHwExec = (0 < get_basic_block_instance_count((*graph)[s].basicblock));
-		bool tHwExec = (0 < get_basic_block_instance_count((*graph)[t].basicblock));
-		// add edge weight <=> transition delay when crossing a hw/cpu boundary
-		unsigned delay = 0;
-		if (sHwExec ^ tHwExec) {
-			bool CPUToHW = true;
-			if (sHwExec == true) {
-				// fpga -> cpu
-				CPUToHW = false;
-			}
-			delay = get_transition_delay((*graph)[s].basicblock, (*graph)[t].basicblock, CPUToHW);
-		} else {
-			// should have no transition penalty, double make sure
-			delay = 0;
-		}
-		boost::put(boost::edge_weight_t(), *graph, *ei, delay);
-	}
-}
-
-
 // Function: get_transition_delay
 // Return: an unsigned int representing the transitional delay between switching from either
 // fpga to cpu, or cpu to fpga
@@ -2155,9 +3819,9 @@ unsigned AdvisorAnalysis::get_transition_delay(BasicBlock *source, BasicBlock *t
 
 void AdvisorAnalysis::print_basic_block_configuration(Function *F) {
 	*outputLog << "Basic Block Configuration:\n";
-	for (auto BB = F->begin(); BB != F->end(); BB++) {
-		int repFactor = get_basic_block_instance_count(BB);
-		*outputLog << BB->getName() << "\t[" << repFactor << "]\n";
+	FunctionInfo *FI = functionMap[F];
+	for (unsigned i = 0; i < FI->bbList.size(); i++) {
+		*outputLog << FI->bbList[i]->getName() << "\t[" << FI->repFactor[i] << "]\n";
 	}
 }
 
@@ -2169,10 +3833,10 @@ void AdvisorAnalysis::print_optimal_configuration_for_all_calls(Function *F) {
 
 		callNum++;
 		std::string outfileName(F->getName().str() + "." + std::to_string(callNum) + ".final.dot");
-		TraceGraphVertexWriter<TraceGraph> vpw(*fIt);
-		TraceGraphEdgeWriter<TraceGraph> epw(*fIt);
+		TraceGraphVertexWriter vpw(*fIt, functionMap[F]->repFactor);
+		TraceGraphEdgeWriter epw(*fIt);
 		std::ofstream outfile(outfileName);
-		boost::write_graphviz(outfile, *fIt, vpw, epw);
+		write_trace_graph_graphviz(outfile, *fIt, vpw, epw);
 	}
 }
 
@@ -2193,6 +3857,86 @@ void AdvisorAnalysis::modify_resource_requirement(Function *F, TraceGraphList_it
 char AdvisorAnalysis::ID = 0;
 static RegisterPass<AdvisorAnalysis> X("fpga-advisor-analysis", "FPGA-Advisor Analysis Pass -- to be executed after instrumentation and program run", false, false);
 
+// Function: FunctionScheduler::load_operation_latency_table
+// Return: false if the table could not be loaded
+// Each line of the file gives the latency in cycles of one operation as the
+// opcode name followed by the latency, e.g.
+//	fmul 5
+//	load 2
+// lines starting with # are comments. Operations which are not listed take
+// 1 cycle.
+bool FunctionScheduler::load_operation_latency_table(StringRef fileName, std::map<unsigned, int> &opLatency) {
+	ErrorOr<std::unique_ptr<MemoryBuffer> > fileOrErr = MemoryBuffer::getFile(fileName);
+	if (std::error_code ec = fileOrErr.getError()) {
+		errs() << "Could not open latency table file " << fileName << ": " << ec.message() << "!\n";
+		return false;
+	}
+
+	StringMap<unsigned> opcodeIndex;
+	for (unsigned op = Instruction::TermOpsBegin; op < Instruction::OtherOpsEnd; op++) {
+		opcodeIndex[Instruction::getOpcodeName(op)] = op;
+	}
+
+	for (line_iterator line(*fileOrErr.get(), true, '#'); !line.is_at_end(); ++line) {
+		std::pair<StringRef, StringRef> fields = line->trim().split(' ');
+		StringRef opName = fields.first.trim();
+		unsigned latency;
+		auto search = opcodeIndex.find(opName);
+		if (search == opcodeIndex.end() || fields.second.trim().getAsInteger(10, latency)) {
+			errs() << "Invalid entry in latency table on line " << line.line_number() << ": " << *line << "!\n";
+			return false;
+		}
+		opLatency[search->getValue()] = (int) latency;
+	}
+
+	return true;
+}
+
+
+// Function: FunctionScheduler::get_basic_block_asap_latency
+// Return: the length in cycles of the critical path of the basic block
+// Each instruction is scheduled as soon as its operands computed in the same
+// basic block are available, other operands are available at cycle 0. Every
+// non-phi instruction comes after the instructions it uses within a basic
+// block, so a single pass in program order is a topological traversal of the
+// dependences. Phi operands from the same basic block are loop carried and do
+// not constrain the schedule. The terminator executes once all other
+// instructions have started. The cycle at which each instruction finishes is
+// added to finishTable if given.
+int FunctionScheduler::get_basic_block_asap_latency(std::map<unsigned, int> &opLatency, BasicBlock *BB, DenseMap<Instruction *, int> *finishTable) {
+	DenseMap<Instruction *, int> finish;
+	int lastStart = 0;
+	int latency = 0;
+	for (auto I = BB->begin(); I != BB->end(); I++) {
+		int start = 0;
+		if (!isa<PHINode>(I)) {
+			for (auto op = I->op_begin(); op != I->op_end(); op++) {
+				Instruction *opI = dyn_cast<Instruction>(op->get());
+				if (!opI) {
+					continue;
+				}
+				auto search = finish.find(opI);
+				if (search != finish.end()) {
+					start = std::max(start, search->second);
+				}
+			}
+		}
+		if (isa<TerminatorInst>(I)) {
+			start = std::max(start, lastStart);
+		}
+
+		int end = start + get_operation_latency(opLatency, I);
+		finish[I] = end;
+		lastStart = std::max(lastStart, start);
+		latency = std::max(latency, end);
+	}
+	if (finishTable) {
+		finishTable->insert(finish.begin(), finish.end());
+	}
+	return latency;
+}
+
+
 char FunctionScheduler::ID = 0;
 static RegisterPass<FunctionScheduler> Z("func-scheduler", "FPGA-Advisor Analysis Function Scheduler Pass", false, false);
 
@@ -18,6 +18,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "FPGA-Advisor-Instrument.h"
+#include "llvm/Support/CommandLine.h"
 
 #define DEBUG_TYPE "fpga-advisor-instrument"
 
@@ -25,16 +26,43 @@ using namespace llvm;
 
 std::error_code IEC;
 
+//===----------------------------------------------------------------------===//
+// Instrumentation Pass options
+//===----------------------------------------------------------------------===//
+
+// Instead of printing the trace as text, call into the buffered binary trace
+// runtime (runtime/FPGA-Advisor-Runtime.c) which must be linked into the
+// instrumented program
+static cl::opt<bool> BinaryTrace("binary-trace", cl::desc("Emit a compact binary trace through the FPGA-Advisor trace runtime"),
+		cl::Hidden, cl::init(false));
+
+// Also record the address and size of every load and store, so that the
+// analysis can use the memory dependences that actually occurred
+static cl::opt<bool> TraceMemory("trace-memory", cl::desc("Record the address and size of each load and store in the trace"),
+		cl::Hidden, cl::init(false));
+
 bool AdvisorInstr::runOnModule(Module &M) {
 	mod = &M;
+	// the module may not specify a data layout, use the default one then
+	DataLayout defaultLayout(&M);
+	DL = M.getDataLayout() ? M.getDataLayout() : &defaultLayout;
 	raw_fd_ostream OL("fpga-advisor-instrument.log", IEC, sys::fs::F_RW);
 	outputLog = &OL;
 	DEBUG(outputLog = &dbgs());
 
 	*outputLog << "FPGA-Advisor and Instrumentation Pass Starting.\n";
 
+	// the function ID used by the binary trace is the position of the function
+	// in the module, it must be computed before any runtime declarations are
+	// appended to the function list
+	std::vector<Function *> functionList;
 	for (auto F = M.begin(), FE = M.end(); F != FE; F++) {
-		instrument_function(F);
+		functionList.push_back(F);
+	}
+
+	for (unsigned funcID = 0; funcID < functionList.size(); funcID++) {
+		Function *F = functionList[funcID];
+		instrument_function(F, funcID);
 		F->print(*outputLog);
 	}
 
@@ -46,16 +74,24 @@ bool AdvisorInstr::runOnModule(Module &M) {
 // such that the insrumented IR will print each function execution as well
 // as each basic block that is executed in the function
 // e.g.) Entering Function: func
-void AdvisorInstr::instrument_function(Function *F) {
+void AdvisorInstr::instrument_function(Function *F, unsigned funcID) {
 	// cannot instrument external functions
 	if (F->isDeclaration()) {
 		return;
 	}
 
+	if (BinaryTrace) {
+		instrument_function_binary(F, funcID);
+		return;
+	}
+
 	// add printf for basicblocks first that way the function name printf
 	// will be printed before the basicblock due to the way the instructions
 	// are inserted (at first insertion point in basic block)
 	for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
+		if (TraceMemory) {
+			instrument_memory_accesses(BB);
+		}
 		instrument_basicblock(BB);
 	}
 
@@ -128,3 +164,93 @@ void AdvisorInstr::instrument_basicblock(BasicBlock *BB) {
 		printfArgs.clear();
 	}
 }
+
+// Function: instrument_function_binary
+// Binary trace counterpart of instrument_function, each basic block calls
+// __fpga_advisor_trace_basicblock(funcID, bbID) and the entry block calls
+// __fpga_advisor_trace_enter(funcID) before that, so the record order matches
+// the text trace
+void AdvisorInstr::instrument_function_binary(Function *F, unsigned funcID) {
+	unsigned bbID = 0;
+	for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++, bbID++) {
+		if (TraceMemory) {
+			instrument_memory_accesses(BB);
+		}
+		instrument_basicblock_binary(BB, funcID, bbID);
+	}
+
+	*outputLog << "Inserting trace call for function: " << F->getName() << " (" << funcID << ")\n";
+
+	LLVMContext &C = mod->getContext();
+	Constant *enterFunc = mod->getOrInsertFunction("__fpga_advisor_trace_enter",
+						Type::getVoidTy(C), Type::getInt32Ty(C), NULL);
+
+	BasicBlock *entry = &(F->getEntryBlock());
+	IRBuilder<> builder(entry->getFirstInsertionPt());
+	builder.CreateCall(enterFunc, builder.getInt32(funcID));
+}
+
+// Function: instrument_basicblock_binary
+// Binary trace counterpart of instrument_basicblock
+void AdvisorInstr::instrument_basicblock_binary(BasicBlock *BB, unsigned funcID, unsigned bbID) {
+	*outputLog << "Inserting trace call for basic block: " << BB->getName() << " (" << bbID << ")\n";
+
+	LLVMContext &C = mod->getContext();
+	Constant *bbFunc = mod->getOrInsertFunction("__fpga_advisor_trace_basicblock",
+						Type::getVoidTy(C), Type::getInt32Ty(C), Type::getInt32Ty(C), NULL);
+
+	IRBuilder<> builder(BB->getFirstInsertionPt());
+	builder.CreateCall2(bbFunc, builder.getInt32(funcID), builder.getInt32(bbID));
+
+	// if this basicblock returns from a function, record that as well
+	if (isa<ReturnInst>(BB->getTerminator())) {
+		Constant *retFunc = mod->getOrInsertFunction("__fpga_advisor_trace_return",
+							Type::getVoidTy(C), Type::getInt32Ty(C), NULL);
+		builder.CreateCall(retFunc, builder.getInt32(funcID));
+	}
+}
+
+// Function: instrument_memory_accesses
+// Records the address and size of each load and store of BB just before it
+// executes, with a "Load: <address> <size>" or "Store: <address> <size>"
+// printf or a call to __fpga_advisor_trace_load/store(address, size) for the
+// binary trace. Accesses outside of the default address space are not
+// recorded.
+void AdvisorInstr::instrument_memory_accesses(BasicBlock *BB) {
+	LLVMContext &C = mod->getContext();
+	std::vector<Instruction *> accesses;
+	for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+		if (isa<LoadInst>(I) || isa<StoreInst>(I)) {
+			accesses.push_back(I);
+		}
+	}
+
+	for (auto it = accesses.begin(); it != accesses.end(); it++) {
+		Instruction *I = *it;
+		bool store = isa<StoreInst>(I);
+		Value *pointer = store ? cast<StoreInst>(I)->getPointerOperand() : cast<LoadInst>(I)->getPointerOperand();
+		if (pointer->getType()->getPointerAddressSpace() != 0) {
+			continue;
+		}
+		Type *type = store ? cast<StoreInst>(I)->getValueOperand()->getType() : I->getType();
+		uint64_t size = DL->getTypeStoreSize(type);
+
+		IRBuilder<> builder(I);
+		if (BinaryTrace) {
+			Constant *memFunc = mod->getOrInsertFunction(store ? "__fpga_advisor_trace_store" : "__fpga_advisor_trace_load",
+								Type::getVoidTy(C), Type::getInt8PtrTy(C), Type::getInt32Ty(C), NULL);
+			builder.CreateCall2(memFunc, builder.CreatePointerCast(pointer, Type::getInt8PtrTy(C)), builder.getInt32(size));
+			continue;
+		}
+
+		FunctionType *printf_type = TypeBuilder<int(char *, ...), false>::get(getGlobalContext());
+		Function *printfFunc = cast<Function>(mod->getOrInsertFunction("printf", printf_type,
+							AttributeSet().addAttribute(mod->getContext(), 1U, Attribute::NoAlias)));
+		std::vector<Value *> printfArgs;
+		StringRef memMsgString = store ? StringRef("Store: %llx %u\n") : StringRef("Load: %llx %u\n");
+		printfArgs.push_back(builder.CreateGlobalStringPtr(memMsgString, "mem_msg_string"));
+		printfArgs.push_back(builder.CreatePtrToInt(pointer, builder.getInt64Ty()));
+		printfArgs.push_back(builder.getInt32(size));
+		builder.CreateCall(printfFunc, printfArgs, llvm::Twine("printf"));
+	}
+}
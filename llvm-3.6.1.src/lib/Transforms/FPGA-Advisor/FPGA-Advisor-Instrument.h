@@ -25,6 +25,7 @@
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/TypeBuilder.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/Support/FileSystem.h"
 
 #include <vector>
@@ -40,9 +41,13 @@ class AdvisorInstr : public ModulePass {
 		AdvisorInstr() : ModulePass(ID) {}
 		bool runOnModule(Module &M);
 	private:
-		void instrument_function(Function *F);
+		void instrument_function(Function *F, unsigned funcID);
 		void instrument_basicblock(BasicBlock *BB);
+		void instrument_function_binary(Function *F, unsigned funcID);
+		void instrument_basicblock_binary(BasicBlock *BB, unsigned funcID, unsigned bbID);
+		void instrument_memory_accesses(BasicBlock *BB);
 		Module *mod;
+		const DataLayout *DL;
 		raw_ostream *outputLog;
 
 }; // end class
@@ -0,0 +1,133 @@
+/*===- FPGA-Advisor-Trace.h - Binary trace format definitions -----*- C -*-===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+\*===----------------------------------------------------------------------===*/
+/*
+ * This file describes the binary trace format written by the FPGA-Advisor
+ * trace runtime (runtime/FPGA-Advisor-Runtime.c) when a program has been
+ * instrumented with -fpga-advisor-instrument -binary-trace, and read back by
+ * the FPGA-Advisor analysis pass.
+ *
+ * It is shared between the C runtime and the C++ analysis, so it must stay
+ * valid C.
+ *
+ * Layout (all fields are in the byte order of the traced host):
+ *
+ *   FPGAAdvisorTraceHeader
+ *   chunk*
+ *
+ * Each chunk is a uint32_t count of the bytes stored in the file and a
+ * uint32_t count of the bytes of FPGAAdvisorTraceRecord entries in the chunk,
+ * followed by the stored bytes. A chunk corresponds to one flush of the runtime
+ * buffer. The stored bytes are the records compressed with the compression
+ * scheme given in the header, or the records themselves if the scheme is
+ * FPGA_ADVISOR_TRACE_COMPRESSION_NONE. Version 1 traces are never compressed
+ * and their chunks only have the first count.
+ *
+ * Programs instrumented with -trace-memory also record each load and store
+ * executed, after the record of the basic block that executes it: the kind is
+ * FPGA_ADVISOR_TRACE_LOAD or FPGA_ADVISOR_TRACE_STORE, the rest of the tag holds
+ * the log2 of the access size and bits 32 to 55 of the address, and block holds
+ * the low 32 bits of the address. The size loses precision: it is rounded up to
+ * a power of 2 and capped at 2^15 bytes, so an access of any other size is read
+ * back as a larger (or, above 2^15 bytes, smaller) one. The text trace has a
+ * "Load: <address> <size>" or "Store: <address> <size>" line instead, with the
+ * address in hexadecimal and the exact size.
+ *
+ * Functions and basic blocks are identified by their position in the module:
+ * the function ID is the index of the function in Module::getFunctionList()
+ * and the basic block ID is the index of the block within its function. The
+ * analysis must therefore be run on the same module that was instrumented
+ * (or on the uninstrumented original, the instrumentation only appends the
+ * runtime declarations and never adds or reorders basic blocks).
+ *
+ * Indexed trace container
+ * -----------------------
+ * A text or binary trace may be converted by the analysis (-index-trace) into
+ * an indexed container that gives access to the calls of a single function
+ * without reading the rest of the trace. All fields are little endian:
+ *
+ *   magic (FPGA_ADVISOR_INDEXED_TRACE_MAGIC), uint32_t version,
+ *   uint32_t reserved, uint64_t offset of the index
+ *   call record*
+ *   index
+ *
+ * A call record is written when the call returns. It is a uint32_t count
+ * followed by the IDs (uint32_t) of the basic blocks executed by one call, in
+ * execution order, then a uint32_t count of the calls it made, each the number
+ * of its basic blocks executed before the callee returned (uint32_t) and the
+ * offset (uint64_t) of the call record of the callee, then a uint32_t count of
+ * its loads and stores, each the number of its basic blocks executed before
+ * the access (uint32_t), FPGA_ADVISOR_TRACE_LOAD or FPGA_ADVISOR_TRACE_STORE
+ * (uint32_t), the size (uint32_t) and the address (uint64_t). The index is an
+ * llvm::OnDiskChainedHashTable keyed by function name, whose data is the
+ * number of basic blocks of the function and their names (each a uint32_t
+ * length followed by the name) followed by the number of calls and the offset
+ * (uint64_t) of each call record from the start of the file. Basic block IDs
+ * index the names of the function, so the container does not depend on the
+ * order of the basic blocks in the module. Version 1 containers have no
+ * callees, loads or stores in their call records and are not read.
+ */
+
+#ifndef LLVM_LIB_TRANSFORMS_FPGA_ADVISOR_TRACE_H
+#define LLVM_LIB_TRANSFORMS_FPGA_ADVISOR_TRACE_H
+
+#include <stdint.h>
+
+#define FPGA_ADVISOR_TRACE_MAGIC "FPGATRCE"
+#define FPGA_ADVISOR_TRACE_MAGIC_SIZE 8
+#define FPGA_ADVISOR_TRACE_VERSION 2
+
+/* compression schemes of the chunks of the binary trace */
+#define FPGA_ADVISOR_TRACE_COMPRESSION_NONE 0
+/* zlib stream, as written by compress2 */
+#define FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB 1
+
+#define FPGA_ADVISOR_INDEXED_TRACE_MAGIC "FPGAIDXT"
+#define FPGA_ADVISOR_INDEXED_TRACE_VERSION 2
+
+/* record kinds, stored in the top bits of the record tag */
+#define FPGA_ADVISOR_TRACE_ENTER 1
+#define FPGA_ADVISOR_TRACE_BASICBLOCK 2
+#define FPGA_ADVISOR_TRACE_RETURN 3
+#define FPGA_ADVISOR_TRACE_LOAD 4
+#define FPGA_ADVISOR_TRACE_STORE 5
+
+#define FPGA_ADVISOR_TRACE_KIND_SHIFT 28
+#define FPGA_ADVISOR_TRACE_ID_MASK 0x0fffffffu
+
+#define FPGA_ADVISOR_TRACE_TAG(kind, funcID) \
+	(((uint32_t) (kind) << FPGA_ADVISOR_TRACE_KIND_SHIFT) | ((uint32_t) (funcID) & FPGA_ADVISOR_TRACE_ID_MASK))
+#define FPGA_ADVISOR_TRACE_TAG_KIND(tag) ((tag) >> FPGA_ADVISOR_TRACE_KIND_SHIFT)
+#define FPGA_ADVISOR_TRACE_TAG_FUNC(tag) ((tag) & FPGA_ADVISOR_TRACE_ID_MASK)
+
+/* tag of a load or store record */
+#define FPGA_ADVISOR_TRACE_SIZE_SHIFT 24
+#define FPGA_ADVISOR_TRACE_ADDRESS_MASK 0x00ffffffu
+#define FPGA_ADVISOR_TRACE_MEMORY_TAG(kind, log2Size, address) \
+	(((uint32_t) (kind) << FPGA_ADVISOR_TRACE_KIND_SHIFT) | ((uint32_t) (log2Size) << FPGA_ADVISOR_TRACE_SIZE_SHIFT) | \
+	((uint32_t) ((uint64_t) (address) >> 32) & FPGA_ADVISOR_TRACE_ADDRESS_MASK))
+#define FPGA_ADVISOR_TRACE_TAG_SIZE(tag) (1u << (((tag) & FPGA_ADVISOR_TRACE_ID_MASK) >> FPGA_ADVISOR_TRACE_SIZE_SHIFT))
+#define FPGA_ADVISOR_TRACE_ADDRESS(tag, block) \
+	((((uint64_t) (tag) & FPGA_ADVISOR_TRACE_ADDRESS_MASK) << 32) | (uint64_t) (block))
+
+typedef struct {
+	char magic[FPGA_ADVISOR_TRACE_MAGIC_SIZE];
+	uint32_t version;
+	/* one of FPGA_ADVISOR_TRACE_COMPRESSION_*, reserved in version 1 */
+	uint32_t compression;
+} FPGAAdvisorTraceHeader;
+
+/* one record per function entry, basic block execution, function return, load
+ * or store, the block field is only meaningful for FPGA_ADVISOR_TRACE_BASICBLOCK
+ * and for loads and stores */
+typedef struct {
+	uint32_t tag;
+	uint32_t block;
+} FPGAAdvisorTraceRecord;
+
+#endif
@@ -17,6 +17,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "Scheduler.h"
+#include "fpga_common.h"
 #include <algorithm>
 
 #define DEBUG_TYPE "module-sched"
@@ -57,8 +58,14 @@ bool Scheduler::runOnModule(Module &M) {
 }
 
 
+// Function: initialize_latency_table
+// Loads the operation latencies from the same table as the FunctionScheduler
 void Scheduler::initialize_latency_table() {
-	// leave an empty table for now -- TODO
+	opLatency.clear();
+	if (!fpga::LatencyTableFile.empty() &&
+		!fpga::FunctionScheduler::load_operation_latency_table(fpga::LatencyTableFile, opLatency)) {
+		opLatency.clear();
+	}
 }
 
 
@@ -75,20 +82,20 @@ void Scheduler::schedule_instructions_in_function(Function *F) {
 
 // Function: schedule_instructions_in_basicblock
 // This function should fill in the instSchedule table for a basic block
+// Every non-phi instruction comes after the instructions of the basic block
+// that it uses, so the instructions are scheduled in a single pass in program
+// order
 void Scheduler::schedule_instructions_in_basicblock(BasicBlock *BB) {
-	int numInstScheduled = 0;
-	int numInstInBB = find_num_inst_in_basicblock(BB);
-	while (numInstScheduled < numInstInBB - 1) {
-		for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
-			if (isa<TerminatorInst>(I)) {
-				continue;
-			}
-			if (schedule_instruction(I)) {
-				numInstScheduled++;
-			}
+	// the latest start cycle of the non-terminal instructions
+	int lastStart = 0;
+	for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+		if (isa<TerminatorInst>(I)) {
+			continue;
 		}
+		schedule_instruction(I);
+		lastStart = std::max(lastStart, instSchedule[I]->cycStart);
 	}
-	schedule_terminal_instruction(BB->getTerminator());
+	schedule_terminal_instruction(BB->getTerminator(), lastStart);
 }
 
 
@@ -97,11 +104,11 @@ void Scheduler::schedule_instructions_in_basicblock(BasicBlock *BB) {
 // when all its dependencies have been scheduled
 // Note: this function does not schedule the terminal instruction, that's
 // handled separately by schedule_terminal_instruction
-bool Scheduler::schedule_instruction(Instruction *I) {
+void Scheduler::schedule_instruction(Instruction *I) {
 	assert(!dyn_cast<TerminatorInst>(I));
 
 	if (is_scheduled(I)) {
-		return false;
+		return;
 	}
 
 	// How to schedule instructions:
@@ -151,10 +158,12 @@ bool Scheduler::schedule_instruction(Instruction *I) {
 				if (opI->getParent() != I->getParent()) {
 					*outputLog << "not in same bb\n";
 					continue;
-				} else if (!is_scheduled(opI)) {
-					*outputLog << "not been scheduled\n";
-					return false;
+				} else if (isa<PHINode>(I)) {
+					// phi operands from the same basic block are loop carried
+					*outputLog << "loop carried\n";
+					continue;
 				} else {
+					assert(is_scheduled(opI));
 					cycleStart = std::max(cycleStart, get_end_cycle(opI) + 1);
 					continue;
 				}
@@ -186,13 +195,12 @@ bool Scheduler::schedule_instruction(Instruction *I) {
 	*scheduleLog << "scheduled instruction: ";
 	I->print(*scheduleLog);
 	*scheduleLog << " starting cycle: " << cycleStart << " last cycle: " << newElem->cycEnd << "\n";
-	
-	return true;
 }
 
 
 // Function: schedule_terminal_instruction
-void Scheduler::schedule_terminal_instruction(Instruction *I) {
+// lastStart is the latest start cycle of the other instructions in the basic block
+void Scheduler::schedule_terminal_instruction(Instruction *I, int lastStart) {
 	assert(dyn_cast<TerminatorInst>(I));
 	*outputLog << "attempt to schedule: "; I->print(*outputLog); *outputLog << "\n";
 	// do the scheduling, the terminal instruction can at the earliest
@@ -201,12 +209,7 @@ void Scheduler::schedule_terminal_instruction(Instruction *I) {
 	// have finished execution, however, if an instruction in subsequent
 	// basic blocks require the result of that instruction, then they will
 	// have to wait. This, however, is computed at run time.
-	int cycleStart = 0;
-	for (auto it = instSchedule.begin(), et = instSchedule.end(); it != et; it++) {
-		if (it->first->getParent() == I->getParent()) {
-			cycleStart = std::max(cycleStart, it->second->cycStart);
-		}
-	}
+	int cycleStart = lastStart;
 	
 	*outputLog << "Scheduled for cycle: " << cycleStart << "\n";
 
@@ -231,15 +234,6 @@ void Scheduler::fill_schedule() {
 }
 
 
-int Scheduler::find_num_inst_in_basicblock(BasicBlock *BB) {
-	int count = 0;
-	for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
-		count++;
-	}
-	return count;
-}
-
-
 // Function: is_scheduled
 // Return: true if the instruction has an existing entry in instSchedule
 //			i.e. it has been scheduled
@@ -262,13 +256,8 @@ int Scheduler::get_end_cycle(Instruction *I) {
 // Return: the latency of the operation
 int Scheduler::find_operation_latency(Instruction *I) {
 	// do a search on the opLatency table to get the latency of operations
-	// if the operation does not exist in the table, assume it is 1 cycle??
-	if (opLatency.find(I->getOpcode()) == opLatency.end()) {
-		*outputLog << "Could not find the latency of operation, default 1. "; I->print(*outputLog); *outputLog << "\n";
-		return 1;
-	} else {
-		return (opLatency.find(I->getOpcode()))->second;
-	}
+	// if the operation does not exist in the table, assume it is 1 cycle
+	return fpga::FunctionScheduler::get_operation_latency(opLatency, I);
 }
 
 
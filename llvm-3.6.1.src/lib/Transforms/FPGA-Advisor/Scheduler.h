@@ -56,10 +56,9 @@ class Scheduler : public ModulePass {
 		void initialize_latency_table();
 		void schedule_instructions_in_function(Function *F);
 		void schedule_instructions_in_basicblock(BasicBlock *BB);
-		bool schedule_instruction(Instruction *I);
-		void schedule_terminal_instruction(Instruction *I);
+		void schedule_instruction(Instruction *I);
+		void schedule_terminal_instruction(Instruction *I, int lastStart);
 		void fill_schedule();
-		int find_num_inst_in_basicblock(BasicBlock *BB);
 		bool is_scheduled(Instruction *I);
 		int find_operation_latency(Instruction *I);
 		int get_end_cycle(Instruction *I);
@@ -78,8 +77,8 @@ class Scheduler : public ModulePass {
 		// opLatency stores the operation latency of various operations
 		// the first field stores the opcode as an unsigned int and the
 		// second field stores the number of cycles latency
-		// assume unknown operation latency as 1?? TODO
-		std::map<unsigned int, unsigned int> opLatency;
+		// unknown operations take 1 cycle
+		std::map<unsigned, int> opLatency;
 		// schedule stores the instructions to execute in each cycle as
 		// a vector of ScheduleElem's, the index of the top level vector
 		// represents the clock cycle
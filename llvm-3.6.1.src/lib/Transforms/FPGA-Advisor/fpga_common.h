@@ -21,7 +21,13 @@
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/LoopInfo.h"
@@ -36,13 +42,19 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/OnDiskHashTable.h"
 
 #include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/depth_first_search.hpp>
-#include <boost/graph/breadth_first_search.hpp>
 #include <boost/graph/graphviz.hpp>
 
 #include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 #include <map>
@@ -53,11 +65,88 @@ using namespace llvm;
 
 namespace fpga {
 
+// DepGraphIndex is stored as the graph property of the dependence graph and
+// makes the dependence queries constant time:
+//	- vertex maps each basic block to its vertex in the graph
+//	- dependent is a numVertices x numVertices bit matrix, bit
+//	(v * numVertices + d) is set if there is an edge v -> d i.e. the basic
+//	block of v depends on the basic block of d
+//	- loopCarried is set if any edge has a carrier loop
+//	- otherMemory has the vertices of the basic blocks with instructions
+//	other than loads and stores that may read or write memory
+typedef struct {
+	DenseMap<BasicBlock *, unsigned> vertex;
+	unsigned numVertices;
+	BitVector dependent;
+	bool loopCarried;
+	BitVector otherMemory;
+} DepGraphIndex;
+
+// kinds of dependence between two instructions
+enum DepKind {
+	// the consumer uses the value of the producer
+	DEP_SSA,
+	// through memory: read after write, write after read, write after write
+	// and the read after read that MemoryDependenceAnalysis reports between
+	// loads of the same location
+	DEP_RAW,
+	DEP_WAR,
+	DEP_WAW,
+	DEP_RAR,
+	// on a call or another instruction whose memory effects are not known,
+	// or a dependence that could not be analyzed
+	DEP_UNKNOWN
+};
+
+// DepGraphCause is a pair of instructions that causes a dependence edge: the
+// consumer in the basic block of v depends on the producer in the basic block
+// of d. producer is NULL when the dependence is on the basic block as a whole,
+// e.g. the dependence on all basic blocks with memory instructions.
+typedef struct {
+	Instruction *producer;
+	Instruction *consumer;
+	DepKind kind;
+} DepGraphCause;
+
+// DepGraphEdge is the property of an edge v -> d of the dependence graph.
+// If carrier is set, the dependence is carried by the loop with that header at
+// a known distance: an execution of v only depends on the executions of d
+// distance iterations earlier of that loop. Otherwise v depends on the most
+// recent execution of d. memory is set if the dependence is only through memory.
+// causes lists the instruction pairs that make v depend on d. A cause with a
+// NULL producer makes v depend on all of d, it is then the only cause.
+typedef struct {
+	BasicBlock *carrier;
+	unsigned distance;
+	bool memory;
+	std::vector<DepGraphCause> causes;
+} DepGraphEdge;
+
+// DepGraphStats holds the cost and precision of the dependence graph of a
+// function, for the report of the DependenceGraph pass:
+//	- runs is the number of times the graph was constructed and time the
+//	seconds spent on them, cached is the number of times it was read from the
+//	cache instead
+//	- unknown is the number of memory instructions whose dependences are not
+//	known, which depend on all basic blocks with memory instructions
+//	- removed is the number of edges between basic blocks with memory
+//	instructions that the graph does not have, i.e. that the dependence on
+//	all basic blocks with memory instructions would have added
+typedef struct {
+	unsigned runs;
+	double time;
+	unsigned cached;
+	unsigned memoryBBs;
+	unsigned unknown;
+	unsigned removed;
+	unsigned edges;
+} DepGraphStats;
+
 // Dependence Graph type:
 // STL list container for OutEdge list
 // STL vector container for vertices
 // Use directed edges
-typedef boost::adjacency_list< boost::listS, boost::vecS, boost::bidirectionalS, BasicBlock * >
+typedef boost::adjacency_list< boost::listS, boost::vecS, boost::bidirectionalS, BasicBlock *, DepGraphEdge, DepGraphIndex >
 		DepGraph;
 typedef DepGraph::vertex_iterator DepGraph_iterator;
 typedef DepGraph::vertex_descriptor DepGraph_descriptor;
@@ -70,47 +159,114 @@ class DependenceGraph : public FunctionPass {
 
 	public:
 		static char ID;
-		void getAnalysisUsage(AnalysisUsage &AU) const override {
-			AU.addPreserved<AliasAnalysis>();
-			AU.setPreservesAll();
-			AU.addRequired<DominatorTreeWrapperPass>();
-			AU.addRequiredTransitive<AliasAnalysis>();
-			//AU.addPreserved<MemoryDependenceAnalysis>();
-			AU.addRequiredTransitive<MemoryDependenceAnalysis>();
-		}
+		void getAnalysisUsage(AnalysisUsage &AU) const override;
 		DependenceGraph() : FunctionPass(ID) {
 			//initializeDependenceGraph(*PassRegistry::getPassRegistry());
 			initializeBasicAliasAnalysisPass(*PassRegistry::getPassRegistry());
+			initializeCFLAliasAnalysisPass(*PassRegistry::getPassRegistry());
+			initializeTypeBasedAliasAnalysisPass(*PassRegistry::getPassRegistry());
+			initializeScopedNoAliasAAPass(*PassRegistry::getPassRegistry());
+			initializeScalarEvolutionAliasAnalysisPass(*PassRegistry::getPassRegistry());
 		}
+		bool doInitialization(Module &M) override;
 		bool runOnFunction(Function &F);
+		bool doFinalization(Module &M) override;
 		DepGraph &getDepGraph() {
-			return DG;
+			return *DG;
+		}
+		// hands the graph of the last function over to the caller, the pass
+		// builds a new graph for the next function
+		std::unique_ptr<DepGraph> takeDepGraph() {
+			return std::move(DG);
 		}
 		static DepGraph_descriptor get_vertex_descriptor_for_basic_block(BasicBlock *BB, DepGraph &DG);
 		static bool is_basic_block_dependent(BasicBlock *BB1, BasicBlock *BB2, DepGraph &DG);
 		static void get_all_basic_block_dependencies(DepGraph &DG, BasicBlock *BB, std::vector<BasicBlock *> &deps);
+		static void get_all_basic_block_dependencies(DepGraph &DG, BasicBlock *BB, std::vector<std::pair<BasicBlock *, const DepGraphEdge *> > &deps);
+		static DepKind get_memory_dependence_kind(Instruction *producer, Instruction *consumer);
 	
 	private:
 		void add_vertices(Function &F);
 		void add_edges();
-		void insert_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB);
+		void insert_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB, Instruction *producer, DepKind kind);
+		void insert_carried_dependent_basic_block(std::vector<BasicBlock *> &list, BasicBlock *BB, BasicBlock *carrier, unsigned distance, Instruction *producer, DepKind kind);
+		void add_dependence_cause(DepGraph_descriptor v, Instruction *producer, DepKind kind);
+		void add_dependence_edge(DepGraph_descriptor v, DepGraph_descriptor dep, const DepGraphEdge &edge);
+		void add_memory_dependences(Instruction *I, std::vector<BasicBlock *> &list);
+		void count_removed_memory_dependences(BasicBlock *BB);
+		std::string get_alias_analysis_configuration();
+		std::string get_cache_file_name(Function &F);
+		bool read_cached_graph(StringRef fileName);
+		void write_cached_graph(StringRef fileName);
+		void print_report(raw_ostream &OS);
 		void insert_dependent_basic_block_all(std::vector<BasicBlock *> &list);
 		void insert_dependent_basic_block_all_memory(std::vector<BasicBlock *> &list);
 		bool unsupported_memory_instruction(Instruction *I);
 
 		Function *func;
 		MemoryDependenceAnalysis *MDA;
+		DependenceAnalysis *DA;
+		LoopInfo *LI;
 		DominatorTree *DT;
-		DepGraph DG;
+		std::unique_ptr<DepGraph> DG;
 		std::vector<std::string> NameVec;
 		// a list of basic blocks that may read or write memory
 		//std::vector<DepGraph_descriptor> MemoryBBs;
 		std::vector<BasicBlock *> MemoryBBs;
+		// the vertices of MemoryBBs
+		BitVector MemoryVertices;
+		// the loads and stores of the function, and the basic blocks with
+		// other instructions that may read or write memory, used with
+		// UseDependenceAnalysis
+		std::vector<Instruction *> MemoryInsts;
+		std::vector<BasicBlock *> OtherMemoryBBs;
+		// the basic blocks already in the dependence list of the basic block
+		// being processed by add_edges, by vertex
+		BitVector currDeps;
+		// the edge to each basic block in the dependence list, by vertex
+		std::vector<DepGraphEdge> currEdges;
+		// the instruction whose dependences add_edges is looking for
+		Instruction *currInst;
+		// the causes of currInst already added, as vertex and producer with
+		// the kind of dependence
+		DenseSet<std::pair<unsigned, std::pair<Instruction *, unsigned> > > currCauses;
+		// the statistics of each function, in the order they were first
+		// analyzed, and of the function being analyzed
+		MapVector<Function *, DepGraphStats> Stats;
+		DepGraphStats *currStats;
+		// set once the cache directory exists
+		bool cacheEnabled;
 }; // end class DependenceGraph
 
+// CallGraphInfo holds the properties of a function that depend on the functions
+// it may call
+typedef struct {
+	// the function is part of a cycle of the call graph
+	bool recursive;
+	// the function is recursive or may call a recursive function
+	bool reachesRecursive;
+	// the function is external or may call an external function, calls
+	// through function pointers are external
+	bool reachesExternal;
+} CallGraphInfo;
+
+// LoopIterInfo describes a natural loop of a function, the loops of a function
+// are listed with each loop before the loops nested in it
 typedef struct {
 	std::vector<Loop*> subloops;
+	// basic block index of the loop header
+	unsigned header;
+	// index of the enclosing loop in loopList, -1 for a top level loop
+	int parent;
+	// the basic blocks of the loop, by basic block index
+	BitVector blocks;
+	// dynamic trip counts, over all executions of the loop in the trace
+	uint64_t invocations;
+	uint64_t minIter;
+	uint64_t totalIter;
 	uint64_t maxIter;
+	// most iterations of one execution of the loop that overlap in the
+	// maximal schedule
 	uint64_t parIter;
 } LoopIterInfo;
 
@@ -118,79 +274,764 @@ typedef struct {
 	Function *function;
 	LoopInfo *loopInfo;
 	std::vector<BasicBlock *> bbList;
+	// position of each basic block in bbList
+	DenseMap<BasicBlock *, unsigned> bbIndex;
+	// replication factor of each basic block, indexed like bbList
+	// 0 represents cpu execution, anything above 0 means hw accel
+	std::vector<int> repFactor;
+	// latency of each basic block, indexed like bbList
+	std::vector<int> latency;
 	std::vector<Instruction *> instList;
 	std::vector<LoopIterInfo> loopList;
+	// index into loopList of the loop headed by each basic block, -1 if the
+	// basic block is not a loop header, indexed like bbList
+	std::vector<int> headerLoop;
+	// average latency of a call in the final configuration, inherited by
+	// callers whose calls are not kept
+	int callLatency;
 	std::vector<LoadInst *> loadList;
 	std::vector<StoreInst *> storeList;
+	// results of the function passes, moved here by run_function_analyses
+	// so that they stay valid while other functions are analyzed
+	std::unique_ptr<DepGraph> dependenceGraph;
+	std::map<BasicBlock *, int> latencyTable;
+	std::map<BasicBlock *, int> areaTable;
+	// cycle at which each instruction finishes within the schedule of its
+	// basic block
+	DenseMap<Instruction *, int> finishTable;
 } FunctionInfo;
 
 
-// TraceGraph vertex property struct representing each individual
-// scheduling element (basic block granularity)
+// TraceGraph represents the execution trace of one call to a function at
+// basic block granularity. Traces may contain tens of millions of basic block
+// executions, so the graph is kept in compressed sparse row form with the
+// vertex properties stored as separate arrays:
+//	- vertices are basic block executions numbered in execution order, each
+//	vertex only stores the index of its basic block in the function
+//	- the in-edges of each vertex are appended while the graph is constructed,
+//	in vertex order, and always come from vertices that executed earlier
+//	- the out-edges are derived once from the in-edges by finalize()
+// An edge A -> B means that B depends on the completion of A. Each edge has a
+// weight representing the transition delay between fpga and cpu.
+// Calls that execute the same basic block sequence have the same graph and
+// schedule, they are represented by a single graph whose multiplicity is the
+// number of such calls.
+typedef unsigned TraceGraph_vertex_descriptor;
+// edges are identified by their position in the in-edge array
+typedef unsigned TraceGraph_edge_descriptor;
+
+// TraceLoopFold describes a run of identical loop iterations of which only the
+// first iterations are kept in the trace graph. The last kept iteration stands
+// for the last iteration of the run, the folded iterations are assumed to
+// execute before it at the initiation interval of the kept iterations.
 typedef struct {
+	// first vertex of the last kept iteration
+	TraceGraph_vertex_descriptor begin;
+	// number of vertices in an iteration
+	unsigned length;
+	// number of iterations kept in the graph, at least 3
+	unsigned kept;
+	// number of iterations removed from the graph
+	uint64_t folded;
+} TraceLoopFold;
+
+class TraceGraph;
+
+// TraceMemoryAccess is a load or store recorded in the trace (see -trace-memory)
+// by the execution of a basic block
+typedef struct {
+	TraceGraph_vertex_descriptor vertex;
+	bool write;
+	// in bytes, rounded up to a power of 2 in binary traces
+	unsigned size;
+	uint64_t address;
+} TraceMemoryAccess;
+
+static inline bool operator==(const TraceMemoryAccess &a, const TraceMemoryAccess &b) {
+	return a.vertex == b.vertex && a.write == b.write && a.size == b.size && a.address == b.address;
+}
+
+// TraceShadow is the memory dependence state of the bytes accessed while the
+// loads and stores of a call are replayed: the last vertex that stored to each
+// byte and the vertices that loaded it since then. The state is kept in pages
+// of consecutive bytes. The loads of a byte are a list of nodes that is shared
+// with the bytes loaded along with it, so a load adds one node for all of its
+// bytes and the state grows with the number of accesses rather than with the
+// number of bytes times the loads of each byte.
+class TraceShadow {
 	public:
-		void set_min_start(int _start) const { minCycStart = _start;}
-		void set_min_end(int _end) const { minCycEnd = _end;}
-		void set_start(int _start) const { cycStart = _start;}
-		void set_end(int _end) const { cycEnd = _end;}
+		// adds the vertices that an access depends on to deps
+		void add_dependences(const TraceMemoryAccess &access, std::vector<TraceGraph_vertex_descriptor> &deps);
+		// records an access once the dependences of its vertex are known
+		void update(const TraceMemoryAccess &access);
 
-		BasicBlock *basicblock;
-		uint64_t ID;
+	private:
+		static const unsigned PageBits = 12;
+		static const unsigned PageSize = 1 << PageBits;
+		typedef struct {
+			// last vertex that stored to each byte, -1 if none
+			int store[PageSize];
+			// first node of the loads of each byte since its last store, -1
+			// if none
+			int loads[PageSize];
+		} TraceShadowPage;
+		TraceShadowPage *get_page(uint64_t address, bool create);
+		// pages by address >> PageBits
+		DenseMap<uint64_t, unsigned> pageIndex;
+		std::vector<std::unique_ptr<TraceShadowPage> > pages;
+		// load nodes: the vertex that made the load and the next node, -1 at
+		// the end of the list
+		std::vector<std::pair<TraceGraph_vertex_descriptor, int> > loadNodes;
+}; // end class TraceShadow
+
+// TraceCallee links a vertex of a trace graph to a call made while the basic
+// block of the vertex executed
+typedef struct {
+	TraceGraph_vertex_descriptor vertex;
+	Function *function;
+	// the trace graph of the call, NULL if the call is not kept (streamed trace)
+	const TraceGraph *call;
+} TraceCallee;
+
+class TraceGraph {
+	public:
+		TraceGraph() : blocks(NULL), multiplicity(1), callLatency(0) {
+			inOffset.push_back(0);
+		}
+
+		//===------------------------------------------------------------===//
+		// Construction
+		//===------------------------------------------------------------===//
+		// the basic blocks of the function, indexed by basic block index
+		void set_basic_block_list(const std::vector<BasicBlock *> *_blocks) {
+			blocks = _blocks;
+		}
+		TraceGraph_vertex_descriptor add_vertex(unsigned blockIndex) {
+			block.push_back(blockIndex);
+			return block.size() - 1;
+		}
+		// callees must be added in vertex order
+		void add_callee(const TraceCallee &callee) {
+			callees.push_back(callee);
+		}
+		// adds a load or store made by the last vertex
+		void add_memory_access(const TraceMemoryAccess &access) {
+			memoryAccesses.push_back(access);
+		}
+		// removes the vertices from n on, before any edge has been added
+		void truncate_vertices(unsigned n) {
+			block.resize(n);
+			while (! callees.empty() && callees.back().vertex >= n) {
+				callees.pop_back();
+			}
+			while (! memoryAccesses.empty() && memoryAccesses.back().vertex >= n) {
+				memoryAccesses.pop_back();
+			}
+		}
+		// true if the length vertices from a and from b execute the same
+		// basic blocks, make the same calls and access the same memory
+		bool same_vertices(TraceGraph_vertex_descriptor a, TraceGraph_vertex_descriptor b, unsigned length) const;
+		// folds must be added in vertex order
+		void add_loop_fold(const TraceLoopFold &fold) {
+			folds.push_back(fold);
+		}
+		// discard all edges and schedules, keeps the vertices
+		void clear_edges() {
+			inOffset.assign(1, 0);
+			inSource.clear();
+			outOffset.clear();
+			outTarget.clear();
+			outEdge.clear();
+			delay.clear();
+			readyOffset.clear();
+		}
+		// in-edges must be added vertex by vertex in execution order,
+		// close_in_edges(v) is called once all in-edges of v have been added
+		void add_in_edge(TraceGraph_vertex_descriptor v, TraceGraph_vertex_descriptor source) {
+			assert(inOffset.size() == v + 1 && source < v);
+			inSource.push_back(source);
+		}
+		// same, v only waits for the first offset cycles of source (see
+		// get_ready_offset), either all or none of the edges have an offset
+		void add_in_edge(TraceGraph_vertex_descriptor v, TraceGraph_vertex_descriptor source, int offset) {
+			add_in_edge(v, source);
+			readyOffset.push_back(offset);
+		}
+		void close_in_edges(TraceGraph_vertex_descriptor v) {
+			assert(inOffset.size() == v + 1);
+			inOffset.push_back(inSource.size());
+		}
+		// builds the out-edge arrays and allocates the schedule arrays
+		void finalize();
+
+		//===------------------------------------------------------------===//
+		// Access
+		//===------------------------------------------------------------===//
+		unsigned num_vertices() const { return block.size(); }
+		unsigned num_edges() const { return inSource.size(); }
+		unsigned get_block_index(TraceGraph_vertex_descriptor v) const { return block[v]; }
+		BasicBlock *get_basic_block(TraceGraph_vertex_descriptor v) const { return (*blocks)[block[v]]; }
+
+		// in-edges of v are the edges [in_begin(v), in_end(v))
+		TraceGraph_edge_descriptor in_begin(TraceGraph_vertex_descriptor v) const { return inOffset[v]; }
+		TraceGraph_edge_descriptor in_end(TraceGraph_vertex_descriptor v) const { return inOffset[v+1]; }
+		unsigned in_degree(TraceGraph_vertex_descriptor v) const { return inOffset[v+1] - inOffset[v]; }
+		TraceGraph_vertex_descriptor source(TraceGraph_edge_descriptor e) const { return inSource[e]; }
+
+		// out-edges of v are the entries [out_begin(v), out_end(v)) of the out
+		// edge array, out_edge(i) gives the corresponding edge
+		unsigned out_begin(TraceGraph_vertex_descriptor v) const { return outOffset[v]; }
+		unsigned out_end(TraceGraph_vertex_descriptor v) const { return outOffset[v+1]; }
+		TraceGraph_edge_descriptor out_edge(unsigned i) const { return outEdge[i]; }
+		TraceGraph_vertex_descriptor target(unsigned i) const { return outTarget[i]; }
+
+		const std::vector<TraceLoopFold> &get_loop_folds() const { return folds; }
+		const std::vector<TraceCallee> &get_callees() const { return callees; }
+		// loads and stores in vertex order, calls and loop iterations are
+		// only merged or folded if they made the same accesses
+		const std::vector<TraceMemoryAccess> &get_memory_accesses() const { return memoryAccesses; }
+
+		// cycles spent in the calls made by vertex v, 0 unless set
+		int get_callee_latency(TraceGraph_vertex_descriptor v) const {
+			return (v < calleeLatency.size()) ? calleeLatency[v] : 0;
+		}
+		void set_callee_latency(TraceGraph_vertex_descriptor v, int latency) {
+			calleeLatency.resize(block.size(), 0);
+			calleeLatency[v] = latency;
+		}
+		// latency of this call in the final configuration of its function,
+		// inherited by the vertices that make the call
+		int get_call_latency() const { return callLatency; }
+		void set_call_latency(int latency) { callLatency = latency; }
+
+		// cycles after the start of the source of edge e at which the
+		// instructions its target depends on have finished, -1 if the target
+		// waits for the whole source
+		int get_ready_offset(TraceGraph_edge_descriptor e) const {
+			return readyOffset.empty() ? -1 : readyOffset[e];
+		}
+
+		unsigned get_delay(TraceGraph_edge_descriptor e) const { return delay[e]; }
+		void set_delay(TraceGraph_edge_descriptor e, unsigned _delay) { delay[e] = _delay; }
+
+		// number of calls represented by this graph
+		unsigned get_multiplicity() const { return multiplicity; }
+		void add_identical_call() { multiplicity++; }
+		// identifies calls with the same basic block sequence, loop folds,
+		// callees and memory accesses
+		size_t hash_basic_blocks() const {
+			hash_code hash = hash_combine_range(block.begin(), block.end());
+			for (auto it = folds.begin(); it != folds.end(); it++) {
+				hash = hash_combine(hash, it->begin, it->length, it->folded);
+			}
+			for (auto it = callees.begin(); it != callees.end(); it++) {
+				hash = hash_combine(hash, it->vertex, it->function, it->call);
+			}
+			for (auto it = memoryAccesses.begin(); it != memoryAccesses.end(); it++) {
+				hash = hash_combine(hash, it->vertex, it->write, it->size, it->address);
+			}
+			return hash;
+		}
+		bool same_basic_blocks(const TraceGraph &other) const {
+			if (block != other.block || folds.size() != other.folds.size() || callees.size() != other.callees.size()
+				|| memoryAccesses != other.memoryAccesses) {
+				return false;
+			}
+			for (unsigned i = 0; i < folds.size(); i++) {
+				if (folds[i].begin != other.folds[i].begin || folds[i].length != other.folds[i].length || folds[i].folded != other.folds[i].folded) {
+					return false;
+				}
+			}
+			for (unsigned i = 0; i < callees.size(); i++) {
+				if (callees[i].vertex != other.callees[i].vertex || callees[i].function != other.callees[i].function || callees[i].call != other.callees[i].call) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//===------------------------------------------------------------===//
+		// Schedule
+		//===------------------------------------------------------------===//
 		// the min cycles represent the earliest the basic block may
 		// execute, this equates to the scheduling without resource
 		// constraint
-		int mutable minCycStart;
-		int mutable minCycEnd;
+		std::vector<int> minCycStart;
+		std::vector<int> minCycEnd;
 		// cycStart and cycEnd are the actual schedules
-		int mutable cycStart;
-		int mutable cycEnd;
-		std::string name;
-} BBSchedElem;
-
-// TraceGraph edge weight property representing transition delay
-// between fpga and cpu
-typedef boost::property<boost::edge_weight_t, unsigned> TransitionDelay;
-// Graph type:
-// STL list container for OutEdge List
-// STL vector container for vertices
-// Use directed edges
-//typedef boost::adjacency_list< boost::listS, boost::vecS, boost::directedS > digraph;
-// trace graph property
-//typedef boost::property<boost::vertex_index_t, BBSchedElem> VertexProperty;
-//typedef boost::adjacency_list< boost::listS, boost::vecS, boost::directedS, VertexProperty > TraceGraph;
-typedef boost::adjacency_list< boost::listS, boost::vecS, boost::bidirectionalS, BBSchedElem, TransitionDelay > TraceGraph;
-//typedef boost::adjacency_list< boost::listS, boost::vecS, boost::directedS, BBSchedElem > TraceGraph;
+		std::vector<int> cycStart;
+		std::vector<int> cycEnd;
+
+	private:
+		const std::vector<BasicBlock *> *blocks;
+		// basic block index of each vertex
+		std::vector<unsigned> block;
+		// in-edges, indexed by vertex through inOffset
+		std::vector<unsigned> inOffset;
+		std::vector<TraceGraph_vertex_descriptor> inSource;
+		// out-edges, indexed by vertex through outOffset
+		std::vector<unsigned> outOffset;
+		std::vector<TraceGraph_vertex_descriptor> outTarget;
+		std::vector<TraceGraph_edge_descriptor> outEdge;
+		// transition delay of each edge
+		std::vector<unsigned> delay;
+		// ready offset of each edge, empty if the edges have none
+		std::vector<int> readyOffset;
+		unsigned multiplicity;
+		// folded loop runs, in vertex order
+		std::vector<TraceLoopFold> folds;
+		// calls made by the vertices, in vertex order
+		std::vector<TraceCallee> callees;
+		std::vector<TraceMemoryAccess> memoryAccesses;
+		// cycles spent in callees by vertex, empty if there are none
+		std::vector<int> calleeLatency;
+		int callLatency;
+}; // end class TraceGraph
+
 typedef std::list<TraceGraph> TraceGraphList; 
 typedef std::map<Function *, TraceGraphList> ExecGraph;
 
 // iterators
-typedef TraceGraph::vertex_iterator TraceGraph_iterator;
 typedef TraceGraphList::iterator TraceGraphList_iterator; 
 typedef ExecGraph::iterator ExecGraph_iterator;
 
-// vertex descriptor
-typedef TraceGraph::vertex_descriptor TraceGraph_vertex_descriptor;
-typedef TraceGraph::edge_descriptor TraceGraph_edge_descriptor;
+// TraceLoopRun is the state of a loop that is being executed while the trace
+// graph of a call is constructed
+typedef struct {
+	// index into loopList
+	int loop;
+	// first vertex of the current iteration and of the previous kept one
+	TraceGraph_vertex_descriptor iterationBegin;
+	TraceGraph_vertex_descriptor previousBegin;
+	// kept iterations of the current run of identical iterations, 0 before
+	// the first iteration completes
+	unsigned kept;
+	// iterations of the current run of identical iterations that were removed
+	uint64_t folded;
+	// iterations of this execution of the loop
+	uint64_t iterations;
+} TraceLoopRun;
+
+// The TraceLoopTracker follows the loops executed by a call while its trace
+// graph is constructed. It records the trip count of each execution of a loop
+// in the LoopIterInfo of the loop, where an iteration is an execution of the
+// loop header.
+// With keep > 0 it also removes repeated loop iterations from the graph, so
+// that the size of the graph and the cost of scheduling it do not depend on
+// the trip counts of its loops. Iterations are compared as they complete, a
+// run of identical iterations keeps its first keep iterations and the rest
+// are recorded as a TraceLoopFold. Iterations that contain a folded loop are
+// never folded themselves.
+class TraceLoopTracker {
+	public:
+		TraceLoopTracker(FunctionInfo *_FI, unsigned _keep) : FI(_FI), keep(_keep) {}
+		// called for each basic block of the call in trace order, before the
+		// vertex of the basic block (if any) is added to the graph
+		void add_basic_block(TraceGraph &graph, unsigned blockIndex);
+		// called once the call has returned
+		void finish(TraceGraph &graph);
 
-// edge iterators
-typedef TraceGraph::out_edge_iterator TraceGraph_out_edge_iterator;
-typedef TraceGraph::in_edge_iterator TraceGraph_in_edge_iterator;
-typedef TraceGraph::edge_iterator TraceGraph_edge_iterator;
+	private:
+		void complete_iteration(TraceGraph &graph, TraceLoopRun &run);
+		void finish_identical_iterations(TraceGraph &graph, TraceLoopRun &run);
+		void leave_loop(TraceGraph &graph);
+
+		FunctionInfo *FI;
+		unsigned keep;
+		// loops being executed, innermost last
+		std::vector<TraceLoopRun> runs;
+}; // end class TraceLoopTracker
+
+// The TransitiveReduction class removes redundant dynamic dependences while a
+// trace graph is being built. A dependence of a vertex on d is redundant if d
+// is also an ancestor of another dependence of the same vertex.
+// Vertex IDs are assigned in execution order so every ancestor of a vertex has
+// a smaller ID. The search for ancestors therefore never needs to go below the
+// smallest dependence, each vertex is visited at most once per query and the
+// search stops as soon as every dependence has been found to be redundant or
+// kept.
+// The dependences removed from a vertex are remembered as shortcuts to some of
+// its ancestors, which the search follows before the edges. A dependence on a
+// vertex executed long before, such as a loop invariant computed at the entry
+// of the function, is then found again through the shortcut of the previous
+// dependence instead of by walking every vertex in between.
+// The vertices must be reduced in execution order.
+class TransitiveReduction {
+	public:
+		TransitiveReduction() : stamp(0) {}
+		void reset(unsigned numVertices) {
+			visited.assign(numVertices, 0);
+			stamp = 0;
+			shortcutOffset.clear();
+			shortcuts.clear();
+		}
+		void reduce(TraceGraph &graph, TraceGraph_vertex_descriptor self, std::vector<TraceGraph_vertex_descriptor> &deps);
 
-// ExecutionOrder map definition
-typedef std::map<BasicBlock *, std::pair<int, std::vector<TraceGraph_vertex_descriptor> > > ExecutionOrder;
-typedef std::list<ExecutionOrder> ExecutionOrderList;
-typedef std::map<Function *, ExecutionOrderList> ExecutionOrderListMap;
+	private:
+		// visited[v] == stamp marks v as an ancestor of a dependence in the
+		// current query, avoids clearing the vector for every query
+		std::vector<unsigned> visited;
+		unsigned stamp;
+		std::vector<TraceGraph_vertex_descriptor> worklist;
+		// the dependences removed from vertex v are
+		// shortcuts[shortcutOffset[v]] up to shortcuts[shortcutOffset[v + 1]]
+		std::vector<unsigned> shortcutOffset;
+		std::vector<TraceGraph_vertex_descriptor> shortcuts;
+}; // end class TransitiveReduction
+
+// The ResourceTable keeps track of the resources available to the resource
+// constrained scheduler:
+//	- each hardware instance of a basic block is represented by the cycle at
+//	which it next becomes available, the instances of the basic block with
+//	index i are the entries [offset[i], offset[i] + count[i]) of free, which
+//	are kept as a min-heap so the earliest available instance is found in
+//	O(1) and occupied in O(log count[i])
+//	- basic blocks without hardware instances execute on the cpu, cpuCycle is
+//	the cycle at which the cpu becomes free
+class ResourceTable {
+	public:
+		void initialize(const std::vector<int> &repFactor) {
+			offset.resize(repFactor.size() + 1);
+			count.resize(repFactor.size());
+			offset[0] = 0;
+			for (unsigned i = 0; i < repFactor.size(); i++) {
+				count[i] = std::max(repFactor[i], 0);
+				offset[i + 1] = offset[i] + count[i];
+			}
+			free.assign(offset.back(), 0);
+			cpuCycle = -1;
+		}
+		bool is_cpu(unsigned blockIndex) const {
+			return count[blockIndex] == 0;
+		}
+		// the cycle at which the earliest available instance becomes free
+		int earliest_available(unsigned blockIndex) const {
+			return free[offset[blockIndex]];
+		}
+		// occupy the earliest available instance until cycle end
+		void occupy(unsigned blockIndex, int end) {
+			auto begin = free.begin() + offset[blockIndex];
+			auto last = begin + count[blockIndex];
+			std::pop_heap(begin, last, std::greater<int>());
+			*(last - 1) = end;
+			std::push_heap(begin, last, std::greater<int>());
+		}
 
-// iterators
-typedef ExecutionOrder::iterator ExecutionOrder_iterator;
-typedef ExecutionOrderList::iterator ExecutionOrderList_iterator;
-typedef ExecutionOrderListMap::iterator ExecutionOrderListMap_iterator;
+		std::vector<unsigned> offset;
+		std::vector<unsigned> count;
+		std::vector<int> free;
+		int cpuCycle;
+}; // end class ResourceTable
+
+// ScheduleSnapshot is the state of the resource constrained scheduler right
+// before vertex is scheduled. Only the instances of the basic blocks that were
+// occupied since the previous snapshot are kept, the free cycles of the
+// instances of blocks[i] follow those of blocks[i - 1] in free (see
+// ListScheduler::restore_snapshot).
+typedef struct {
+	TraceGraph_vertex_descriptor vertex;
+	int lastCycle;
+	int cpuCycle;
+	std::vector<unsigned> blocks;
+	std::vector<int> free;
+} ScheduleSnapshot;
+
+// ScheduleCache holds the result of a full resource constrained schedule of
+// one call, and a snapshot before the first execution of each basic block
+// with hardware instances. Removing an instance of basic block i does not
+// change the schedule of the vertices that execute before basic block i does,
+// so a candidate configuration only needs to reschedule the calls that
+// execute basic block i, starting from its snapshot.
+typedef struct {
+	unsigned latency;
+	// index into snapshots for each basic block index, -1 if the basic block
+	// is not executed in hardware by this call
+	std::vector<int> snapshotIndex;
+	std::vector<ScheduleSnapshot> snapshots;
+} ScheduleCache;
+
+// TraceEvent is one record of the trace with its names or IDs resolved, kind is
+// one of the FPGA_ADVISOR_TRACE_* record kinds of FPGA-Advisor-Trace.h
+typedef struct {
+	unsigned kind;
+	Function *function;
+	// only for basic block records
+	BasicBlock *basicBlock;
+	// only for load and store records, function is not set
+	uint64_t address;
+	unsigned size;
+} TraceEvent;
+
+// TraceChunk is a piece of the trace file that is parsed independently of the
+// other pieces, error is set if the piece could not be parsed
+typedef struct {
+	StringRef data;
+	std::vector<TraceEvent> events;
+	std::string error;
+} TraceChunk;
+
+// IndexedTraceEntry is the index entry of one function in the indexed trace
+// container (see FPGA-Advisor-Trace.h)
+typedef struct {
+	FunctionInfo *info;
+	// offsets of the call records of the function
+	std::vector<uint64_t> calls;
+} IndexedTraceEntry;
+
+// IndexedTraceAccess is a load or store of a call in the indexed trace
+// container, position is the number of basic blocks of the call executed
+// before it
+typedef struct {
+	uint32_t position;
+	bool write;
+	uint32_t size;
+	uint64_t address;
+} IndexedTraceAccess;
+
+// IndexedTraceCall is a call that is still executing while a trace is
+// converted into the indexed trace container
+typedef struct {
+	// basic block indices, in execution order
+	std::vector<uint32_t> blocks;
+	// the number of basic blocks executed before each callee returned and
+	// the offset of the call record of the callee
+	std::vector<std::pair<uint32_t, uint64_t> > callees;
+	std::vector<IndexedTraceAccess> accesses;
+} IndexedTraceCall;
+
+// hash of the function names in the index of the indexed trace container,
+// stable across hosts and builds
+inline uint64_t get_indexed_trace_hash(StringRef functionName) {
+	MD5 hash;
+	hash.update(functionName);
+	MD5::MD5Result result;
+	hash.final(result);
+	return support::endian::read<uint64_t, support::little, support::unaligned>(result);
+}
+
+// IndexedTraceWriterTrait describes the index entries to the
+// OnDiskChainedHashTableGenerator
+class IndexedTraceWriterTrait {
+	public:
+		typedef StringRef key_type;
+		typedef StringRef key_type_ref;
+		typedef const IndexedTraceEntry *data_type;
+		typedef const IndexedTraceEntry *data_type_ref;
+		typedef uint64_t hash_value_type;
+		typedef uint64_t offset_type;
+
+		static hash_value_type ComputeHash(key_type_ref key) {
+			return get_indexed_trace_hash(key);
+		}
+		static std::pair<offset_type, offset_type> EmitKeyDataLength(raw_ostream &out, key_type_ref key, data_type_ref data) {
+			support::endian::Writer<support::little> LE(out);
+			offset_type keyLength = key.size();
+			offset_type dataLength = sizeof(uint32_t) + sizeof(uint64_t) * (1 + data->calls.size());
+			for (auto BB = data->info->bbList.begin(); BB != data->info->bbList.end(); BB++) {
+				dataLength += sizeof(uint32_t) + (*BB)->getName().size();
+			}
+			LE.write<offset_type>(keyLength);
+			LE.write<offset_type>(dataLength);
+			return std::make_pair(keyLength, dataLength);
+		}
+		static void EmitKey(raw_ostream &out, key_type_ref key, offset_type keyLength) {
+			out.write(key.data(), keyLength);
+		}
+		static void EmitData(raw_ostream &out, key_type_ref key, data_type_ref data, offset_type dataLength) {
+			support::endian::Writer<support::little> LE(out);
+			LE.write<uint32_t>(data->info->bbList.size());
+			for (auto BB = data->info->bbList.begin(); BB != data->info->bbList.end(); BB++) {
+				StringRef name = (*BB)->getName();
+				LE.write<uint32_t>(name.size());
+				out.write(name.data(), name.size());
+			}
+			LE.write<uint64_t>(data->calls.size());
+			for (auto it = data->calls.begin(); it != data->calls.end(); it++) {
+				LE.write<uint64_t>(*it);
+			}
+		}
+}; // end class IndexedTraceWriterTrait
 
+// IndexedTraceLookupTrait reads the index entries of an indexed trace
+// container, the data of an entry is returned unparsed
+class IndexedTraceLookupTrait {
+	public:
+		typedef StringRef internal_key_type;
+		typedef StringRef external_key_type;
+		typedef StringRef data_type;
+		typedef uint64_t hash_value_type;
+		typedef uint64_t offset_type;
+
+		static bool EqualKey(internal_key_type a, internal_key_type b) { return a == b; }
+		static internal_key_type GetInternalKey(external_key_type key) { return key; }
+		static hash_value_type ComputeHash(internal_key_type key) {
+			return get_indexed_trace_hash(key);
+		}
+		static std::pair<offset_type, offset_type> ReadKeyDataLength(const unsigned char *&data) {
+			offset_type keyLength = support::endian::readNext<offset_type, support::little, support::unaligned>(data);
+			offset_type dataLength = support::endian::readNext<offset_type, support::little, support::unaligned>(data);
+			return std::make_pair(keyLength, dataLength);
+		}
+		static internal_key_type ReadKey(const unsigned char *data, offset_type keyLength) {
+			return StringRef((const char *) data, keyLength);
+		}
+		static data_type ReadData(internal_key_type key, const unsigned char *data, offset_type dataLength) {
+			return StringRef((const char *) data, dataLength);
+		}
+}; // end class IndexedTraceLookupTrait
+
+typedef OnDiskChainedHashTable<IndexedTraceLookupTrait> IndexedTraceIndex;
+
+// IndexedTraceWriter converts a trace into the indexed trace container. Each
+// call is written as soon as it returns, only the calls that are still
+// executing and the offsets of the written calls are held in memory.
+class IndexedTraceWriter {
+	public:
+		IndexedTraceWriter(raw_fd_ostream &_out);
+		void enter_function(FunctionInfo *FI);
+		void add_basic_block(FunctionInfo *FI, unsigned blockIndex);
+		void add_memory_access(bool write, uint64_t address, unsigned size);
+		void return_from_function(FunctionInfo *FI);
+		// writes the calls that never returned and the index, returns the
+		// offset of the index
+		uint64_t finish();
+
+	private:
+		uint64_t write_call(FunctionInfo *FI);
+
+		raw_fd_ostream &out;
+		// the calls that are still executing, the innermost call of each
+		// function is the last one
+		// (kept in trace order so that the container is deterministic)
+		MapVector<FunctionInfo *, std::vector<IndexedTraceCall> > openCalls;
+		// the functions of the calls that are still executing, innermost
+		// last, as traceCallStack when the trace is read
+		std::vector<FunctionInfo *> callStack;
+		MapVector<FunctionInfo *, IndexedTraceEntry> entries;
+}; // end class IndexedTraceWriter
+
+// TraceSummary accumulates the results of the calls to a function when the
+// trace is streamed (-stream-trace), each call is discarded once it has been
+// added to the summary. The peak concurrency of each basic block is kept in
+// the replication factors of the function. The first pass over the trace
+// keeps the calls that fit within -stream-trace-cache vertices in
+// executionGraph, the later passes take them from there instead of building
+// and reducing their graphs again.
+typedef struct {
+	// number of calls added to the summary so far
+	unsigned calls;
+	// total latency of the calls in the current configuration
+	unsigned latency;
+	// total latency of the calls with one instance of each candidate basic
+	// block removed, by candidate
+	std::vector<unsigned> candidates;
+	std::vector<unsigned> candidateLatency;
+	// number of calls read from the trace in the current pass
+	unsigned position;
+	// by position, true if the call is held in executionGraph, on its own or
+	// merged into an identical call
+	std::vector<bool> kept;
+	// vertices of the calls held in executionGraph
+	uint64_t keptVertices;
+	// true if every call is held in executionGraph, the trace is then not
+	// read again
+	bool complete;
+} TraceSummary;
+
+// WorkerPool runs a job on several threads at once and waits for all of them
+// to return from it. The threads are started by the first job that needs them
+// and are kept until the pool is destroyed, so that jobs that are run often
+// (e.g. once per call and gradient descent step) do not start threads each
+// time. The calling thread takes part in every job.
+class WorkerPool {
+	public:
+		WorkerPool() : active(0), generation(0), running(0), stopping(false) {}
+		~WorkerPool();
+		void run(unsigned numThreads, const std::function<void()> &job);
+
+	private:
+		void work(unsigned index);
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		// signals a new job (or stopping) to the threads, and the end of
+		// the job to run
+		std::condition_variable started;
+		std::condition_variable finished;
+		const std::function<void()> *job;
+		// number of pool threads taking part in the current job
+		unsigned active;
+		// incremented for each job
+		unsigned generation;
+		// pool threads that have not returned from the current job yet
+		unsigned running;
+		bool stopping;
+}; // end class WorkerPool
+
+// The ListScheduler schedules the basic block executions of a trace graph.
+// Vertices are taken from the priority list given by the execution order of
+// the trace, which is also a topological order of the graph, so each vertex
+// is ready as soon as all of its parents have been scheduled. A vertex starts
+// once its latest finishing parent (plus transition delay) has finished and,
+// in the resource constrained mode, once the earliest available instance of
+// its resource is free. Scheduling a graph takes O((V + E) log R).
+//	- unconstrained: every basic block may execute as early as possible, used
+//	to find the maximal configuration, the schedule is written to the min
+//	cycles and the actual cycles of the graph
+//	- constrained: basic blocks with hardware instances in repFactor occupy one
+//	of their instances, the others occupy the cpu, edges crossing a hw/cpu
+//	boundary incur a transition delay
+// A scheduler only reads the trace graph when rescheduling, so a separate
+// scheduler per thread may reschedule the same graph concurrently.
+class ListScheduler {
+	public:
+		ListScheduler() : latency(NULL), repFactor(NULL) {}
+		// latency of each basic block by basic block index
+		void initialize(const std::vector<int> *_latency) {
+			latency = _latency;
+			repFactor = NULL;
+		}
+		void initialize(const std::vector<int> *_latency, const std::vector<int> *_repFactor) {
+			latency = _latency;
+			repFactor = _repFactor;
+			resources.initialize(*repFactor);
+		}
+		// schedules the whole graph, records the schedule and transition
+		// delays in the graph and the snapshots in cache if given
+		int schedule(TraceGraph &graph, ScheduleCache *cache);
+		// schedules the graph with one instance of basic block blockIndex
+		// removed (from repFactor already) with respect to the configuration
+		// that was cached, the graph holds the cached schedule and is not
+		// modified
+		int reschedule(TraceGraph &graph, ScheduleCache &cache, unsigned blockIndex);
+
+	private:
+		int schedule_vertices(TraceGraph &graph, TraceGraph_vertex_descriptor first, int lastCycle, int *start, int *end, bool update, ScheduleCache *cache);
+		void restore_snapshot(ScheduleCache &cache, unsigned snapshotIndex);
+
+		const std::vector<int> *latency;
+		const std::vector<int> *repFactor;
+		ResourceTable resources;
+		// basic blocks whose instances were occupied since the last snapshot
+		std::vector<bool> occupied;
+		std::vector<unsigned> occupiedBlocks;
+		// basic blocks whose instances were restored from a snapshot
+		std::vector<bool> restored;
+		// schedule of the rescheduled vertices
+		std::vector<int> scratchStart;
+		std::vector<int> scratchEnd;
+}; // end class ListScheduler
+
+// name of the file giving the latency of each operation, see
+// FunctionScheduler::load_operation_latency_table
+extern cl::opt<std::string> LatencyTableFile;
+
+// The FunctionScheduler class estimates the hardware latency of each basic block
+// in a function as the length of the critical path of an ASAP schedule of its
+// instructions, using the operation latencies given by LatencyTableFile
 class FunctionScheduler : public FunctionPass , public InstVisitor<FunctionScheduler> {
 	public:
 		static char ID;
-		FunctionScheduler() : FunctionPass(ID) {}
+		FunctionScheduler() : FunctionPass(ID), opLatencyLoaded(false) {}
 		void getAnalysisUsage(AnalysisUsage &AU) const override {
 			AU.addPreserved<AliasAnalysis>();
 			AU.addPreserved<MemoryDependenceAnalysis>();
@@ -198,9 +1039,28 @@ class FunctionScheduler : public FunctionPass , public InstVisitor<FunctionSched
 			AU.setPreservesAll();
 		}
 		bool runOnFunction(Function &F) {
+			if (!opLatencyLoaded) {
+				if (!LatencyTableFile.empty() && !load_operation_latency_table(LatencyTableFile, opLatency)) {
+					opLatency.clear();
+				}
+				opLatencyLoaded = true;
+			}
+			// the tables of the previous function may have been moved out
+			latencyTable.clear();
+			finishTable.clear();
 			visit(F);
 			return true;
 		}
+		static bool load_operation_latency_table(StringRef fileName, std::map<unsigned, int> &opLatency);
+		static int get_operation_latency(std::map<unsigned, int> &opLatency, Instruction *I) {
+			// operations not in the table take 1 cycle
+			auto search = opLatency.find(I->getOpcode());
+			if (search == opLatency.end()) {
+				return 1;
+			}
+			return search->second;
+		}
+		static int get_basic_block_asap_latency(std::map<unsigned, int> &opLatency, BasicBlock *BB, DenseMap<Instruction *, int> *finishTable = NULL);
 		static int get_basic_block_latency(std::map<BasicBlock *, int> &LT, BasicBlock *BB) {
 			auto search = LT.find(BB);
 			assert(search != LT.end());
@@ -216,15 +1076,22 @@ class FunctionScheduler : public FunctionPass , public InstVisitor<FunctionSched
 		}
 	
 		void visitBasicBlock(BasicBlock &BB) {
-			int latency = 0;
-			// approximate latency of basic block as number of instructions
-			for (auto I = BB.begin(); I != BB.end(); I++) {
-				latency++;
-			}
+			// approximate latency of basic block as its critical path
+			int latency = get_basic_block_asap_latency(opLatency, &BB, &finishTable);
 			latencyTable.insert(std::make_pair(BB.getTerminator()->getParent(), latency));
 		}
+		int get_instruction_finish(Instruction *I) {
+			auto search = finishTable.find(I);
+			assert(search != finishTable.end());
+			return search->second;
+		}
 	
 		std::map<BasicBlock *, int> latencyTable;
+		// cycle at which each instruction finishes within its basic block
+		DenseMap<Instruction *, int> finishTable;
+		// latency of each operation by opcode
+		std::map<unsigned, int> opLatency;
+		bool opLatencyLoaded;
 	
 }; // end class FunctionScheduler
 
@@ -247,6 +1114,8 @@ class FunctionAreaEstimator : public FunctionPass, public InstVisitor<FunctionAr
 			AU.setPreservesAll();
 		}
 		bool runOnFunction(Function &F) {
+			// the table of the previous function may have been moved out
+			areaTable.clear();
 			visit(F);
 			return true;
 		}
@@ -381,111 +1250,6 @@ class FunctionAreaEstimator : public FunctionPass, public InstVisitor<FunctionAr
 }; // end class FunctionAreaEstimator
 
 
-// Unconstrained scheduler -- does not account for resource limitations in scheduling
-class ScheduleVisitor : public boost::default_dfs_visitor {
-	public:
-		int mutable lastCycle;
-		TraceGraphList_iterator graph_ref;
-		int *lastCycle_ref;
-		std::map<BasicBlock *, int> &LT;
-		ScheduleVisitor(TraceGraphList_iterator graph, std::map<BasicBlock *, int> &_LT, int &lastCycle) : graph_ref(graph), LT(_LT), lastCycle_ref(&lastCycle) {}
-
-		void discover_vertex(TraceGraph_vertex_descriptor v, const TraceGraph &graph) const {
-			// find the latest finishing parent
-			// if no parent, start at 0
-			int start = -1;
-			TraceGraph_in_edge_iterator ii, ie;
-			for (boost::tie(ii, ie) = boost::in_edges(v, graph); ii != ie; ii++) {
-				start = std::max(start, graph[boost::source(*ii, graph)].minCycEnd);
-			}
-			start += 1;
-
-			int end = start;
-			end += FunctionScheduler::get_basic_block_latency(LT, graph[v].basicblock);
-
-			//std::cerr << "Schedule vertex: (" << v << ") " << graph[v].basicblock->getName().str() <<
-			//			" start: " << start << " end: " << end << "\n";
-			(*graph_ref)[v].set_min_start(start);
-			(*graph_ref)[v].set_min_end(end);
-			(*graph_ref)[v].set_start(start);
-			(*graph_ref)[v].set_end(end);
-
-			// keep track of the last cycle as seen by the scheduler
-			*lastCycle_ref = std::max(*lastCycle_ref, end);
-			//std::cerr << "LastCycle: " << *lastCycle_ref << "\n";
-		}
-}; // end class ScheduleVisitor
-
-
-class ConstrainedScheduleVisitor : public boost::default_bfs_visitor {
-	public:
-		int mutable lastCycle;
-		TraceGraph *graph_ref;
-		int *lastCycle_ref;
-		int *cpuCycle_ref;
-		std::map<BasicBlock *, int> &LT;
-		std::map<BasicBlock *, std::pair<bool, std::vector<unsigned> > > &resourceTable;
-		ConstrainedScheduleVisitor(TraceGraph &graph, std::map<BasicBlock *, int> &_LT, int &lastCycle, int &cpuCycle, std::map<BasicBlock *, std::pair<bool, std::vector<unsigned> > > &_resourceTable) : graph_ref(&graph), LT(_LT), lastCycle_ref(&lastCycle), cpuCycle_ref(&cpuCycle),  resourceTable(_resourceTable) {}
-
-		void discover_vertex(TraceGraph_vertex_descriptor v, const TraceGraph &graph) const {
-			// find the latest finishing parent
-			// if no parent, start at 0
-			int start = -1;
-			TraceGraph_in_edge_iterator ii, ie;
-			for (boost::tie(ii, ie) = boost::in_edges(v, graph); ii != ie; ii++) {
-				int transitionDelay = (int) boost::get(boost::edge_weight_t(), graph, *ii);
-				start = std::max(start, graph[boost::target(*ii, graph)].minCycEnd + transitionDelay);
-			}
-			start += 1;
-
-			// this differs from the maximal parallelism configuration scheduling
-			// in that it also considers resource requirement
-			
-			// first sort the vector
-			auto search = resourceTable.find(graph[v].basicblock);
-			//assert(search != resourceTable.end());
-			if (search == resourceTable.end()) {
-				// if not found, could mean that either
-				// a) basic block to be executed on cpu
-				// b) resource table not initialized properly o.o
-				std::cerr << "Basic block " << graph[v].name << " not found in resource table.\n";
-				assert(0);
-			}
-
-			bool cpu = (search->second).first;
-			int resourceReady = UINT_MAX;
-			std::vector<unsigned> &resourceVector = search->second.second;
-			if (cpu) { // cpu resource flag
-				resourceReady = *cpuCycle_ref;
-			} else {
-				std::sort(resourceVector.begin(), resourceVector.end());
-				resourceReady = resourceVector.front();
-			}
-
-			start = std::max(start, resourceReady);
-
-			int end = start;
-			end += FunctionScheduler::get_basic_block_latency(LT, graph[v].basicblock);
-			
-			// update the occupied resource with the new end cycle
-			if (cpu) {
-				*cpuCycle_ref = end;
-			} else {
-				resourceVector.front() = end;
-			}
-
-			//std::cerr << "Schedule vertex: " << graph[v].basicblock->getName().str() <<
-			//			" start: " << start << " end: " << end << "\n";
-			(*graph_ref)[v].set_start(start);
-			(*graph_ref)[v].set_end(end);
-
-			// keep track of last cycle as seen by scheduler
-			*lastCycle_ref = std::max(*lastCycle_ref, end);
-			//std::cerr << "LastCycle: " << *lastCycle_ref << "\n";
-		}
-}; // end class ConstrainedScheduleVisitor
-
-
 class AdvisorAnalysis : public ModulePass, public InstVisitor<AdvisorAnalysis> {
 	public:
 		static char ID;
@@ -500,38 +1264,60 @@ class AdvisorAnalysis : public ModulePass, public InstVisitor<AdvisorAnalysis> {
 			AU.addRequired<FunctionScheduler>();
 			AU.addRequired<FunctionAreaEstimator>();
 		}
-		AdvisorAnalysis() : ModulePass(ID) {}
+		AdvisorAnalysis() : ModulePass(ID), traceWriter(NULL), memoryTrace(false), streamFunction(NULL) {}
 		bool runOnModule(Module &M);
 		void visitFunction(Function &F);
 		void visitBasicBlock(BasicBlock &BB);
 		void visitInstruction(Instruction &I);
-		static int get_basic_block_instance_count(BasicBlock *BB);
+		static unsigned get_transition_delay(BasicBlock *source, BasicBlock *target, bool CPUToHW);
 
 	private:
 		// functions
 		void find_recursive_functions(Module &M);
-		void does_function_recurse(Function *func, CallGraphNode *CGN, std::vector<Function *> &stack);
 		void print_recursive_functions();
 		bool run_on_function(Function *F);
+		LoopInfo &run_function_analyses(Function &F, FunctionInfo *FI);
 		bool has_unsynthesizable_construct(Function *F);
 		bool is_recursive_function(Function *F);
 		bool has_recursive_call(Function *F);
-		bool does_function_call_recursive_function(CallGraphNode *CGN);
 		bool has_external_call(Function *F);
-		bool does_function_call_external_function(CallGraphNode *CGN);
 		//void instrument_function(Function *F);
 		//void instrument_basicblock(BasicBlock *BB);
 
 		void print_statistics();
 
 		bool get_program_trace(std::string fileIn);
+		bool get_binary_program_trace(MemoryBuffer &buffer);
+		bool parse_text_trace_chunk(TraceChunk &chunk);
+		bool parse_binary_trace_chunk(TraceChunk &chunk);
+		bool parse_zlib_binary_trace_chunk(TraceChunk &chunk);
+		bool parse_binary_trace_records(StringRef records, TraceChunk &chunk);
+		bool parse_program_trace(std::vector<StringRef> &pieces, bool (AdvisorAnalysis::*parse)(TraceChunk &));
+		bool get_indexed_program_trace(MemoryBuffer &buffer);
+		bool read_indexed_function_entry(IndexedTraceIndex &index, Function *F, std::vector<BasicBlock *> &blocks, std::vector<uint64_t> &calls);
+		bool read_indexed_call_record(MemoryBuffer &buffer, Function *F, std::vector<BasicBlock *> &blocks, uint64_t offset, DenseMap<uint64_t, Function *> &recordFunctions, DenseMap<uint64_t, const TraceGraph *> &keptCalls);
+		bool convert_program_trace(std::string fileIn, std::string fileOut);
+		void add_function_call_to_trace(Function *F);
+		void add_basic_block_to_trace(BasicBlock *BB);
+		void add_memory_access_to_trace(bool write, uint64_t address, unsigned size);
+		const TraceGraph *complete_function_call(Function *F);
+		TraceGraph *merge_identical_call(Function *F);
+		void add_callee_to_trace(Function *caller, Function *F, const TraceGraph *call);
+		void update_callee_latencies(TraceGraph &graph);
+		void finish_loop_tracking(TraceGraph &graph);
+		void find_parallel_iterations_for_call(Function *F, TraceGraphList_iterator graph_it);
+		bool stream_program_trace(Function *F, bool (AdvisorAnalysis::*handler)(Function *, TraceGraphList_iterator));
+		void start_streamed_function(Function *F);
+		void keep_streamed_call(Function *F, unsigned position);
 		bool check_trace_sanity();
-		BasicBlock *find_basicblock_by_name(std::string funcName, std::string bbName);
-		Function *find_function_by_name(std::string funcName);
+		void build_name_index();
+		BasicBlock *find_basicblock_by_name(StringRef funcName, StringRef bbName);
+		Function *find_function_by_name(StringRef funcName);
 
 		// functions that do analysis on trace
 		bool find_maximal_configuration_for_all_calls(Function *F);
-		bool find_maximal_configuration_for_call(Function *F, TraceGraphList_iterator graph, ExecutionOrderList_iterator execOrder, std::vector<TraceGraph_vertex_descriptor> &rootVertices);
+		bool find_maximal_schedule_for_call(Function *F, TraceGraphList_iterator graph_it);
+		bool find_maximal_configuration_for_call(Function *F, TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &rootVertices);
 		//bool find_maximal_configuration_for_call(Function *F, TraceGraphList_iterator graph_it, std::vector<TraceGraph_vertex_descriptor> &rootVertices);
 		bool basicblock_is_dependent(BasicBlock *child, BasicBlock *parent, TraceGraph &graph);
 		bool instruction_is_dependent(Instruction *inst1, Instruction *inst2);
@@ -540,34 +1326,43 @@ class AdvisorAnalysis : public ModulePass, public InstVisitor<AdvisorAnalysis> {
 		void find_new_parents(std::vector<TraceGraph_vertex_descriptor> &newParents, TraceGraph_vertex_descriptor child, TraceGraph_vertex_descriptor parent, TraceGraph &graph);
 		bool annotate_schedule_for_call(Function *F, TraceGraphList_iterator graph_it, std::vector<TraceGraph_vertex_descriptor> &rootVertices, int &lastCycle);
 		bool find_maximal_resource_requirement(Function *F, TraceGraphList_iterator graph_it, std::vector<TraceGraph_vertex_descriptor> &rootVertices, int lastCycle);
-		bool latest_parent(TraceGraph_out_edge_iterator edge, TraceGraphList_iterator graph);
+		bool latest_parent(TraceGraph_vertex_descriptor thisParent, TraceGraph_vertex_descriptor child, TraceGraphList_iterator graph);
 		void modify_resource_requirement(Function *F, TraceGraphList_iterator graph_it);
 		void find_optimal_configuration_for_all_calls(Function *F);
 		void incremental_gradient_descent(Function *F, BasicBlock *&removeBB, int &deltaDelay);
+		int get_basic_block_instance_count(BasicBlock *BB);
 		void set_basic_block_instance_count(BasicBlock *BB, int value);
 		void initialize_basic_block_instance_count(Function *F);
 		bool decrement_basic_block_instance_count(BasicBlock *BB);
 		bool increment_basic_block_instance_count(BasicBlock *BB);
+		void annotate_basic_block_instance_count(Function *F);
 		void find_root_vertices(std::vector<TraceGraph_vertex_descriptor> &roots, TraceGraphList_iterator graph_it);
-		unsigned schedule_with_resource_constraints(std::vector<TraceGraph_vertex_descriptor> &roots, TraceGraphList_iterator graph_it, Function *F);
-		void initialize_resource_table(Function *F, std::map<BasicBlock *, std::pair<bool, std::vector<unsigned> > > &resourceTable);
+		unsigned schedule_with_resource_constraints(TraceGraphList_iterator graph_it, Function *F, ScheduleCache *cache);
+		void verify_candidate_latencies(Function *F, std::vector<TraceGraph *> &graphs, std::vector<unsigned> &candidates, std::vector<unsigned> &latencies);
+		void evaluate_candidate_latencies(Function *F, std::vector<TraceGraph *> &graphs, std::vector<unsigned> &candidates, std::vector<unsigned> &latencies);
+		bool summarize_candidate_latencies_for_call(Function *F, TraceGraphList_iterator graph_it);
+		bool summarize_final_configuration_for_call(Function *F, TraceGraphList_iterator graph_it);
 		unsigned get_area_requirement(Function *F);
-		void update_transition_delay(TraceGraphList_iterator graph);
-		unsigned get_transition_delay(BasicBlock *source, BasicBlock *target, bool CPUToHW);
-		void remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps);
-		void recursively_remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps, std::vector<TraceGraph_vertex_descriptor>::iterator search, TraceGraph_vertex_descriptor v);
+		void remove_redundant_dynamic_dependencies(TraceGraphList_iterator graph, TraceGraph_vertex_descriptor self, std::vector<TraceGraph_vertex_descriptor> &dynamicDeps);
 
 		void print_basic_block_configuration(Function *F);
 		void print_optimal_configuration_for_all_calls(Function *F);
-		void print_execution_order(ExecutionOrderList_iterator execOrder);
 
 		// define some data structures for collecting statistics
 		std::vector<Function *> functionList;
 		std::vector<Function *> recursiveFunctionList;
+		// call graph properties of each function, see find_recursive_functions
+		std::unordered_map<Function *, CallGraphInfo> callGraphInfo;
 		//std::vector<std::pair<Loop *, bool> > loopList;
 
 		// recursive and external functions are included
 		std::unordered_map<Function *, FunctionInfo *> functionMap;
+
+		// name lookup tables for resolving the text trace
+		StringMap<Function *> functionNameIndex;
+		std::unordered_map<Function *, StringMap<BasicBlock *> > basicBlockNameIndex;
+		// functions by their position in the module, for the binary trace
+		std::vector<Function *> functionIndex;
 	
 		Module *mod;
 		CallGraph *callGraph;
@@ -579,48 +1374,75 @@ class AdvisorAnalysis : public ModulePass, public InstVisitor<AdvisorAnalysis> {
 		// represents the basicblock execution of one call to that function
 		//std::map<Function *, std::list<std::list<BBSchedElem> > > executionTrace;
 
+		// name of the trace that is analyzed, the indexed trace if the trace
+		// has been converted
+		std::string traceFileName;
 		ExecGraph executionGraph;
-
-		ExecutionOrderListMap executionOrderListMap;
+		// follows the loops of each call that is being read, see
+		// TraceLoopTracker
+		std::unordered_map<TraceGraph *, TraceLoopTracker> loopTrackers;
+		// the functions whose calls are open while the trace is read,
+		// innermost last
+		std::vector<Function *> traceCallStack;
+		// when a trace is converted, its calls are passed to traceWriter
+		// instead of being added to executionGraph
+		IndexedTraceWriter *traceWriter;
+		// set once a load or store has been read from the trace, the memory
+		// dependences between loads and stores are then taken from the trace
+		bool memoryTrace;
+		// the distinct calls in executionGraph by the hash of their basic block
+		// sequence
+		std::unordered_map<Function *, std::unordered_multimap<size_t, TraceGraphList_iterator> > callIndex;
+
+		// removes redundant dynamic dependences during trace graph construction
+		TransitiveReduction dependenceReduction;
+
+		// schedules the configuration under gradient descent
+		ListScheduler constrainedScheduler;
+		// cached schedule of each call to the function under gradient descent
+		std::vector<ScheduleCache> scheduleCache;
+		// evaluates the gradient descent candidates concurrently
+		WorkerPool workerPool;
+
+		// when the trace is streamed, only the calls to streamFunction are
+		// kept in executionGraph, each call is passed to streamHandler as soon
+		// as it returns and is then discarded unless it is small enough to be
+		// kept for the next pass, see keep_streamed_call
+		Function *streamFunction;
+		bool (AdvisorAnalysis::*streamHandler)(Function *, TraceGraphList_iterator);
+		TraceSummary streamSummary;
 
 		//DepGraph depGraph;
 
 }; // end class AdvisorAnalysis
 
-// put after AdvisorAnalysis class -- uses a function from class
 // TraceGraph custom vertex writer for execution trace graph output to dotfile
-template <class TraceGraph>
+// basic blocks with hw instances in repFactor are highlighted
 class TraceGraphVertexWriter {
 	public:
-		TraceGraphVertexWriter(TraceGraph& _graph) : graph(_graph) {}
-		template <class TraceGraph_vertex_descriptor>
+		TraceGraphVertexWriter(TraceGraph& _graph, const std::vector<int> &_repFactor) : graph(_graph), repFactor(_repFactor) {}
 		void operator()(std::ostream& out, const TraceGraph_vertex_descriptor &v) const {
-			/*
-			out << "[shape = \"record\" label=\"<r0 fontcolor=Red> " << graph[v].cycStart << "| <r1>"
-				<< graph[v].name << "| <r2>"
-				<< graph[v].cycEnd << "\"]";
-			*/
+			std::string name = graph.get_basic_block(v)->getName().str();
 			out << "[shape=\"none\" label=<<table border=\"0\" cellspacing=\"0\">";
-			out	<< "<tr><td bgcolor=\"green\" border=\"1\"> " << graph[v].cycStart << "</td></tr>";
-			if (AdvisorAnalysis::get_basic_block_instance_count(graph[v].basicblock) > 0) {
-				out	<< "<tr><td bgcolor=\"gray\" border=\"1\"> " << graph[v].name << " (" << v << ")" << "</td></tr>";
+			out	<< "<tr><td bgcolor=\"green\" border=\"1\"> " << graph.cycStart[v] << "</td></tr>";
+			if (repFactor[graph.get_block_index(v)] > 0) {
+				out	<< "<tr><td bgcolor=\"gray\" border=\"1\"> " << name << " (" << v << ")" << "</td></tr>";
 			} else {
-				out	<< "<tr><td border=\"1\"> " << graph[v].name << " (" << v << ") " << "</td></tr>";
+				out	<< "<tr><td border=\"1\"> " << name << " (" << v << ") " << "</td></tr>";
 			}
-			out	<< "<tr><td bgcolor=\"cyan\" border=\"1\"> " << graph[v].cycEnd << "</td></tr>";
+			out	<< "<tr><td bgcolor=\"cyan\" border=\"1\"> " << graph.cycEnd[v] << "</td></tr>";
 			out	<< "</table>>]";
 		}
 	private:
 		TraceGraph &graph;
+		const std::vector<int> &repFactor;
 }; // end class TraceGraphVertexWriter
 
-template <class TraceGraph>
 class TraceGraphEdgeWriter {
 	public:
 		TraceGraphEdgeWriter(TraceGraph& _graph) : graph(_graph) {}
-		template <class TraceGraph_edge_descriptor>
 		void operator()(std::ostream& out, const TraceGraph_edge_descriptor &e) const {
-			unsigned delay = boost::get(boost::edge_weight_t(), graph, e);
+			unsigned delay = graph.get_delay(e);
 			if (delay > 0) {
 				out << "[color=\"blue\" penwidth=\"3\" label=\"" << delay << "\"]";
 			}
@@ -629,7 +1451,25 @@ class TraceGraphEdgeWriter {
 		TraceGraph &graph;
 }; // end class TraceGraphEdgeWriter
 
-
+// Function: write_trace_graph_graphviz
+// Writes the trace graph in dot format, in the same form as boost::write_graphviz
+template <class VertexWriter, class EdgeWriter>
+void write_trace_graph_graphviz(std::ostream &out, TraceGraph &graph, VertexWriter vpw, EdgeWriter epw) {
+	out << "digraph G {\n";
+	for (TraceGraph_vertex_descriptor v = 0; v < graph.num_vertices(); v++) {
+		out << v;
+		vpw(out, v);
+		out << ";\n";
+	}
+	for (TraceGraph_vertex_descriptor v = 0; v < graph.num_vertices(); v++) {
+		for (TraceGraph_edge_descriptor e = graph.in_begin(v); e != graph.in_end(v); e++) {
+			out << graph.source(e) << "->" << v << " ";
+			epw(out, e);
+			out << ";\n";
+		}
+	}
+	out << "}\n";
+}
 
 } // end fpga namespace
 
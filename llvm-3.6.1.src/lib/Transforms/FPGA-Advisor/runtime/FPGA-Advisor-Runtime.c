@@ -0,0 +1,199 @@
+/*===- FPGA-Advisor-Runtime.c - Buffered binary trace runtime ------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+\*===----------------------------------------------------------------------===*/
+/*
+ * Support library linked into programs instrumented with
+ * -fpga-advisor-instrument -binary-trace (and optionally -trace-memory). Every
+ * instrumentation hook appends one fixed size record to a process wide buffer,
+ * the buffer is written out to the trace file as a single chunk whenever it
+ * fills up and once more when the program exits. The runtime is built both as
+ * a static library to link with and as a module for lli -load.
+ *
+ * When the runtime is built with zlib (FPGA_ADVISOR_TRACE_ZLIB), each chunk is
+ * compressed before it is written and the instrumented program must also be
+ * linked with -lz.
+ *
+ * Environment variables:
+ *   FPGA_ADVISOR_TRACE_FILE        name of the trace file (default: trace.bin)
+ *   FPGA_ADVISOR_TRACE_RECORDS     number of records buffered before a flush
+ *                                  (default: 1M records, i.e. 8MB)
+ *   FPGA_ADVISOR_TRACE_COMPRESSION none or zlib (default: zlib if available)
+ *
+ * The runtime is not thread safe, the same restriction applies to the
+ * printf based text trace which interleaves output from different threads.
+ */
+
+#include "../FPGA-Advisor-Trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+#include <zlib.h>
+#endif
+
+#define FPGA_ADVISOR_DEFAULT_TRACE_FILE "trace.bin"
+#define FPGA_ADVISOR_DEFAULT_TRACE_RECORDS (1u << 20)
+
+static FILE *TraceFile = NULL;
+static FPGAAdvisorTraceRecord *TraceBuffer = NULL;
+static uint32_t TraceBufferSize = 0;
+static uint32_t TraceBufferPos = 0;
+/* set once initialization failed so we do not retry on every record */
+static int TraceDisabled = 0;
+static uint32_t TraceCompression = FPGA_ADVISOR_TRACE_COMPRESSION_NONE;
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+/* holds the compressed chunk, large enough for the worst case */
+static Bytef *CompressBuffer = NULL;
+static uLong CompressBufferSize = 0;
+#endif
+
+static void fpga_advisor_flush_trace(void) {
+	/* bytes stored in the file and bytes of records */
+	uint32_t sizes[2];
+	const void *data = TraceBuffer;
+	if (!TraceFile || TraceBufferPos == 0) {
+		return;
+	}
+	sizes[1] = TraceBufferPos * (uint32_t) sizeof(FPGAAdvisorTraceRecord);
+	sizes[0] = sizes[1];
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+	if (TraceCompression == FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB) {
+		uLongf compressedSize = CompressBufferSize;
+		/* favour speed, the traces are repetitive enough to compress well */
+		if (compress2(CompressBuffer, &compressedSize, (const Bytef *) TraceBuffer, sizes[1], Z_BEST_SPEED) != Z_OK) {
+			fprintf(stderr, "FPGA-Advisor: failed to compress trace chunk, trace is incomplete.\n");
+			TraceBufferPos = 0;
+			return;
+		}
+		data = CompressBuffer;
+		sizes[0] = (uint32_t) compressedSize;
+	}
+#endif
+	if (fwrite(sizes, sizeof(sizes), 1, TraceFile) != 1 ||
+		fwrite(data, 1, sizes[0], TraceFile) != sizes[0]) {
+		fprintf(stderr, "FPGA-Advisor: failed to write trace chunk, trace is incomplete.\n");
+	}
+	TraceBufferPos = 0;
+}
+
+static void fpga_advisor_finalize_trace(void) {
+	fpga_advisor_flush_trace();
+	if (TraceFile) {
+		fclose(TraceFile);
+		TraceFile = NULL;
+	}
+	free(TraceBuffer);
+	TraceBuffer = NULL;
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+	free(CompressBuffer);
+	CompressBuffer = NULL;
+#endif
+}
+
+static int fpga_advisor_initialize_trace(void) {
+	const char *fileName;
+	const char *records;
+	const char *compression;
+	FPGAAdvisorTraceHeader header;
+
+	if (TraceDisabled) {
+		return 0;
+	}
+
+	fileName = getenv("FPGA_ADVISOR_TRACE_FILE");
+	if (!fileName || !*fileName) {
+		fileName = FPGA_ADVISOR_DEFAULT_TRACE_FILE;
+	}
+
+	TraceBufferSize = FPGA_ADVISOR_DEFAULT_TRACE_RECORDS;
+	records = getenv("FPGA_ADVISOR_TRACE_RECORDS");
+	if (records && atol(records) > 0) {
+		TraceBufferSize = (uint32_t) atol(records);
+	}
+
+	compression = getenv("FPGA_ADVISOR_TRACE_COMPRESSION");
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+	if (!compression || strcmp(compression, "none") != 0) {
+		TraceCompression = FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB;
+	}
+#else
+	if (compression && strcmp(compression, "none") != 0) {
+		fprintf(stderr, "FPGA-Advisor: runtime built without zlib, trace is not compressed.\n");
+	}
+#endif
+
+	TraceBuffer = (FPGAAdvisorTraceRecord *) malloc(TraceBufferSize * sizeof(FPGAAdvisorTraceRecord));
+#ifdef FPGA_ADVISOR_TRACE_ZLIB
+	if (TraceCompression == FPGA_ADVISOR_TRACE_COMPRESSION_ZLIB) {
+		CompressBufferSize = compressBound(TraceBufferSize * sizeof(FPGAAdvisorTraceRecord));
+		CompressBuffer = (Bytef *) malloc(CompressBufferSize);
+		if (!CompressBuffer) {
+			free(TraceBuffer);
+			TraceBuffer = NULL;
+		}
+	}
+#endif
+	TraceFile = fopen(fileName, "wb");
+	if (!TraceBuffer || !TraceFile) {
+		fprintf(stderr, "FPGA-Advisor: could not open trace file %s, tracing disabled.\n", fileName);
+		fpga_advisor_finalize_trace();
+		TraceDisabled = 1;
+		return 0;
+	}
+
+	memcpy(header.magic, FPGA_ADVISOR_TRACE_MAGIC, FPGA_ADVISOR_TRACE_MAGIC_SIZE);
+	header.version = FPGA_ADVISOR_TRACE_VERSION;
+	header.compression = TraceCompression;
+	fwrite(&header, sizeof(header), 1, TraceFile);
+
+	atexit(fpga_advisor_finalize_trace);
+	return 1;
+}
+
+static void fpga_advisor_append_record(uint32_t tag, uint32_t block) {
+	if (!TraceBuffer && !fpga_advisor_initialize_trace()) {
+		return;
+	}
+	TraceBuffer[TraceBufferPos].tag = tag;
+	TraceBuffer[TraceBufferPos].block = block;
+	if (++TraceBufferPos == TraceBufferSize) {
+		fpga_advisor_flush_trace();
+	}
+}
+
+/* instrumentation hooks, called from code inserted by AdvisorInstr */
+
+void __fpga_advisor_trace_enter(uint32_t funcID) {
+	fpga_advisor_append_record(FPGA_ADVISOR_TRACE_TAG(FPGA_ADVISOR_TRACE_ENTER, funcID), 0);
+}
+
+void __fpga_advisor_trace_basicblock(uint32_t funcID, uint32_t bbID) {
+	fpga_advisor_append_record(FPGA_ADVISOR_TRACE_TAG(FPGA_ADVISOR_TRACE_BASICBLOCK, funcID), bbID);
+}
+
+void __fpga_advisor_trace_return(uint32_t funcID) {
+	fpga_advisor_append_record(FPGA_ADVISOR_TRACE_TAG(FPGA_ADVISOR_TRACE_RETURN, funcID), 0);
+}
+
+static void fpga_advisor_append_memory_record(uint32_t kind, const void *address, uint32_t size) {
+	uint32_t log2Size = 0;
+	while (log2Size < 15 && (1u << log2Size) < size) {
+		log2Size++;
+	}
+	fpga_advisor_append_record(FPGA_ADVISOR_TRACE_MEMORY_TAG(kind, log2Size, (uintptr_t) address), (uint32_t) (uintptr_t) address);
+}
+
+void __fpga_advisor_trace_load(const void *address, uint32_t size) {
+	fpga_advisor_append_memory_record(FPGA_ADVISOR_TRACE_LOAD, address, size);
+}
+
+void __fpga_advisor_trace_store(const void *address, uint32_t size) {
+	fpga_advisor_append_memory_record(FPGA_ADVISOR_TRACE_STORE, address, size);
+}
@@ -0,0 +1,46 @@
+# Inspects the binary traces written by the FPGA-Advisor trace runtime, see
+# lib/Transforms/FPGA-Advisor/FPGA-Advisor-Trace.h.
+#
+#   binary-trace.py header <trace>    prints the header and the chunk count
+#   binary-trace.py v1 <trace> <out>  rewrites an uncompressed trace as a
+#                                     version 1 trace
+
+import struct
+import sys
+
+HEADER = struct.Struct('=8sII')
+COUNT = struct.Struct('=I')
+
+
+def read_trace(name):
+    with open(name, 'rb') as f:
+        data = f.read()
+    magic, version, compression = HEADER.unpack_from(data, 0)
+    if version != 2:
+        sys.exit('unexpected version %d' % version)
+    chunks = []
+    offset = HEADER.size
+    while offset < len(data):
+        stored, = COUNT.unpack_from(data, offset)
+        offset += 2 * COUNT.size
+        chunks.append(data[offset:offset + stored])
+        offset += stored
+    return magic, version, compression, chunks
+
+
+def main():
+    magic, version, compression, chunks = read_trace(sys.argv[2])
+    if sys.argv[1] == 'header':
+        print('version %d compression %d chunks %d' % (version, compression, len(chunks)))
+    elif sys.argv[1] == 'v1':
+        if compression != 0:
+            sys.exit('cannot rewrite a compressed trace')
+        with open(sys.argv[3], 'wb') as f:
+            f.write(HEADER.pack(magic, 1, 0))
+            for chunk in chunks:
+                f.write(COUNT.pack(len(chunk)))
+                f.write(chunk)
+
+
+if __name__ == '__main__':
+    main()
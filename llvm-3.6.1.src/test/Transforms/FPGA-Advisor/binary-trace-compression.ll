@@ -0,0 +1,18 @@
+; The trace runtime compresses the chunks of the binary trace with zlib unless
+; FPGA_ADVISOR_TRACE_COMPRESSION is none. Traces with several chunks, whether
+; compressed, stored as they are or written in the version 1 format, give the
+; results of the text trace of trace-analysis.ll.
+; REQUIRES: zlib
+; RUN: rm -rf %t && mkdir -p %t && cd %t
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument -binary-trace %S/trace-analysis.ll -S -o binary.ll
+; RUN: env FPGA_ADVISOR_TRACE_FILE=zlib.bin FPGA_ADVISOR_TRACE_RECORDS=16 %lli -load %llvmshlibdir/FPGA-Advisor-rt%shlibext binary.ll
+; RUN: env FPGA_ADVISOR_TRACE_FILE=none.bin FPGA_ADVISOR_TRACE_RECORDS=16 FPGA_ADVISOR_TRACE_COMPRESSION=none %lli -load %llvmshlibdir/FPGA-Advisor-rt%shlibext binary.ll
+; RUN: %python %S/Inputs/binary-trace.py header zlib.bin | FileCheck %s --check-prefix=ZLIB
+; RUN: %python %S/Inputs/binary-trace.py header none.bin | FileCheck %s --check-prefix=NONE
+; RUN: %python %S/Inputs/binary-trace.py v1 none.bin v1.bin
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=zlib.bin %S/trace-analysis.ll -disable-output 2>&1 | FileCheck %S/trace-analysis.ll
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=none.bin %S/trace-analysis.ll -disable-output 2>&1 | FileCheck %S/trace-analysis.ll
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=v1.bin %S/trace-analysis.ll -disable-output 2>&1 | FileCheck %S/trace-analysis.ll
+
+; ZLIB: version 2 compression 1 chunks {{[2-9]|[1-9][0-9]+}}
+; NONE: version 2 compression 0 chunks {{[2-9]|[1-9][0-9]+}}
@@ -0,0 +1,78 @@
+; Each iteration of the loop of @recurrence loads what the iteration two steps
+; earlier stored. Without -dg-dependence-analysis the load depends on the most
+; recent execution of the store, with it the dependence is carried by the loop
+; at distance 2.
+; The stores of @pair to %p and %q have different types, only -dg-aa=tbaa
+; tells them apart and removes the dependence between their basic blocks.
+; The store to %r may alias the one to %p under any alias analysis.
+; RUN: rm -rf %t && mkdir -p %t && cd %t
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report %s -disable-output 2>&1 | FileCheck %s --check-prefix=DEFAULT
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-dependence-analysis %s -disable-output 2>&1 | FileCheck %s --check-prefix=DA
+; RUN: FileCheck %s --check-prefix=CARRIED < dependence-graph.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-aa=basicaa %s -disable-output 2>&1 | FileCheck %s --check-prefix=BASICAA
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-aa=tbaa %s -disable-output 2>&1 | FileCheck %s --check-prefix=TBAA
+
+; The report columns are: function, runs, cached, seconds, edges, memory
+; blocks, unknown dependences and removed memory edges.
+; DEFAULT: alias analyses: default
+; DEFAULT: pair 1 0 {{[0-9.]+}} 3 3 0 6
+; DEFAULT: recurrence 1 0 {{[0-9.]+}} 3 2 1 1
+
+; DA: alias analyses: basicaa, with DependenceAnalysis
+; DA: recurrence 1 0 {{[0-9.]+}} 2 2 0 2
+
+; BASICAA: alias analyses: basicaa
+; BASICAA: pair 1 0 {{[0-9.]+}} 3 3 0 6
+
+; TBAA: alias analyses: basicaa tbaa
+; TBAA: pair 1 0 {{[0-9.]+}} 2 3 0 7
+
+; dependence-graph.log is left with the graph of the last function.
+; CARRIED: Looking at dependencies for instruction: %x = load i32* %src
+; CARRIED-NEXT: This instruction may read/modify memory
+; CARRIED-NEXT: Loop carried dependence at distance 2 of loop body on: store i32 %y, i32* %dst from basic block: update
+
+define void @pair(i32* %p, float* %q, i32* %r) {
+entry:
+  store i32 1, i32* %p, !tbaa !1
+  br label %float
+
+float:
+  store float 1.0, float* %q, !tbaa !3
+  br label %same
+
+same:
+  store i32 2, i32* %r, !tbaa !1
+  %v = load i32* %p, !tbaa !1
+  ret void
+}
+
+define void @recurrence(i32* %a, i32 %n) {
+entry:
+  br label %body
+
+body:
+  %i = phi i64 [ 2, %entry ], [ %next, %update ]
+  %prev = add i64 %i, -2
+  %src = getelementptr inbounds i32* %a, i64 %prev
+  %x = load i32* %src
+  %y = add i32 %x, 1
+  br label %update
+
+update:
+  %dst = getelementptr inbounds i32* %a, i64 %i
+  store i32 %y, i32* %dst
+  %next = add i64 %i, 1
+  %count = sext i32 %n to i64
+  %done = icmp sge i64 %next, %count
+  br i1 %done, label %exit, label %body
+
+exit:
+  ret void
+}
+
+!0 = !{!"tbaa root"}
+!1 = !{!2, !2, i64 0}
+!2 = !{!"int", !0, i64 0}
+!3 = !{!4, !4, i64 0}
+!4 = !{!"float", !0, i64 0}
@@ -0,0 +1,57 @@
+; The dependence graph of each function is read back from -dg-cache-dir by the
+; runs after the first one, unless a lock file shows that another process is
+; writing it or the attributes of a callee have changed. A lock file older than
+; a minute is left by a writer that died and is taken over.
+; RUN: rm -rf %t && mkdir -p %t && cd %t
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache %s -disable-output 2>&1 | FileCheck %s --check-prefix=BUILT
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache %s -disable-output 2>&1 | FileCheck %s --check-prefix=CACHED
+; A fresh lock keeps the graphs out of the cache, a stale one does not.
+; RUN: for f in cache/*.dg; do rm $f && touch $f.lock; done
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache %s -disable-output 2>&1 | FileCheck %s --check-prefix=BUILT
+; RUN: FileCheck %s --check-prefix=LOCKED < dependence-graph.log
+; RUN: touch -t 200001010000 cache/*.lock
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache %s -disable-output 2>&1 | FileCheck %s --check-prefix=BUILT
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache %s -disable-output 2>&1 | FileCheck %s --check-prefix=CACHED
+; Only the graph of the function calling @scale is constructed again when the
+; attributes of @scale change.
+; RUN: sed -e 's/attributes #0 = { nounwind readnone }/attributes #0 = { nounwind readonly }/' %s > readonly.ll
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -depgraph -dg-report -dg-cache-dir=cache readonly.ll -disable-output 2>&1 | FileCheck %s --check-prefix=CALLEE
+
+; BUILT: copy{{[[:space:]]+}}1{{[[:space:]]+}}0{{[[:space:]]}}
+; BUILT: scaled{{[[:space:]]+}}1{{[[:space:]]+}}0{{[[:space:]]}}
+; BUILT: total{{[[:space:]]+}}2{{[[:space:]]+}}0{{[[:space:]]}}
+
+; CACHED: copy{{[[:space:]]+}}0{{[[:space:]]+}}1{{[[:space:]]}}
+; CACHED: scaled{{[[:space:]]+}}0{{[[:space:]]+}}1{{[[:space:]]}}
+; CACHED: total{{[[:space:]]+}}0{{[[:space:]]+}}2{{[[:space:]]}}
+
+; LOCKED: Dependence graph cache file is being written by another process
+
+; CALLEE: copy{{[[:space:]]+}}0{{[[:space:]]+}}1{{[[:space:]]}}
+; CALLEE: scaled{{[[:space:]]+}}1{{[[:space:]]+}}0{{[[:space:]]}}
+; CALLEE: total{{[[:space:]]+}}1{{[[:space:]]+}}1{{[[:space:]]}}
+
+define void @copy(i32* %a, i32* %b) {
+entry:
+  %x = load i32* %a
+  br label %store
+
+store:
+  store i32 %x, i32* %b
+  ret void
+}
+
+define void @scaled(i32* %a, i32* %b) {
+entry:
+  %x = load i32* %a
+  %y = call i32 @scale(i32 %x) #0
+  br label %store
+
+store:
+  store i32 %y, i32* %b
+  ret void
+}
+
+declare i32 @scale(i32) #0
+
+attributes #0 = { nounwind readnone }
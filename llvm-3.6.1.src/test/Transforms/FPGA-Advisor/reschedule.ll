@@ -0,0 +1,73 @@
+; Check that rescheduling a call from a snapshot gives the same latency as a
+; full schedule for every gradient descent candidate. The iterations of both
+; loops in work are independent, so both loop blocks start with many instances.
+; RUN: rm -rf %t && mkdir -p %t/1 %t/4 && cd %t
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument %s -S -o instrumented.ll
+; RUN: %lli instrumented.ll > trace.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -verify-reschedule -trace-file=trace.log %s -disable-output 2>&1 | FileCheck %s
+
+; CHECK-NOT: differs
+; CHECK: Number of Functions : 2
+
+; The candidates evaluated by several threads lead to the same configurations
+; as with a single thread.
+; RUN: cd %t/1 && opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -fpga-advisor-threads=1 -trace-file=../trace.log %s -disable-output
+; RUN: cd %t/4 && opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -fpga-advisor-threads=4 -trace-file=../trace.log %s -disable-output
+; RUN: diff %t/1/fpga-advisor-analysis.log %t/4/fpga-advisor-analysis.log
+; RUN: FileCheck %s --check-prefix=CONFIG < %t/4/fpga-advisor-analysis.log
+
+; CONFIG: Examine function: work
+; CONFIG: Final optimal basic block configuration.
+; CONFIG-NEXT: Basic Block Configuration:
+; CONFIG-NEXT: entry [0]
+; CONFIG-NEXT: first [12]
+; CONFIG-NEXT: middle [1]
+; CONFIG-NEXT: second [12]
+; CONFIG-NEXT: exit [0]
+
+@a = global [16 x i32] zeroinitializer
+
+define void @work(i32* %a, i32 %n) {
+entry:
+  br label %first
+
+first:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %first ]
+  %t0 = mul i32 %i, %i
+  %t1 = mul i32 %t0, %i
+  %t2 = mul i32 %t1, 7
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %first, label %middle
+
+middle:
+  %c0 = add i32 %t2, 1
+  br label %second
+
+second:
+  %j = phi i32 [ 0, %middle ], [ %j.next, %second ]
+  %u0 = mul i32 %j, %c0
+  %u1 = mul i32 %u0, %u0
+  %j.next = add nsw i32 %j, 1
+  %cmp2 = icmp slt i32 %j.next, %n
+  br i1 %cmp2, label %second, label %exit
+
+exit:
+  ret void
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %k = phi i32 [ 0, %entry ], [ %k.next, %loop ]
+  %n = add i32 %k, 10
+  call void @work(i32* getelementptr inbounds ([16 x i32]* @a, i32 0, i32 0), i32 %n)
+  %k.next = add i32 %k, 1
+  %done = icmp eq i32 %k.next, 3
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 0
+}
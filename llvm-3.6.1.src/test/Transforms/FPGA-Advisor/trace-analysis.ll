@@ -0,0 +1,127 @@
+; Record the trace of a small program and check the schedule of each function.
+; stencil carries a dependence through memory from each iteration to the next,
+; the iterations of sum only depend on the entry block.
+; RUN: rm -rf %t && mkdir -p %t && cd %t
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument %s -S -o instrumented.ll
+; RUN: %lli instrumented.ll > trace.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=trace.log %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+; The streamed trace gives the same result whether the calls are kept in
+; memory between the passes or read again each time.
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -stream-trace -trace-file=trace.log %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -stream-trace -stream-trace-cache=0 -trace-file=trace.log %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+; The binary trace written by the trace runtime gives the same result.
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument -binary-trace %s -S -o binary.ll
+; RUN: env FPGA_ADVISOR_TRACE_FILE=binary.bin %lli -load %llvmshlibdir/FPGA-Advisor-rt%shlibext binary.ll
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=binary.bin %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+; So does the trace converted into the indexed container, which keeps the
+; callees of each call, also when it is streamed.
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -index-trace=trace.idx -trace-file=trace.log %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -stream-trace -index-trace=binary.idx -trace-file=binary.bin %s -disable-output 2>&1 | FileCheck %s
+; RUN: FileCheck %s --check-prefix=CONFIG < fpga-advisor-analysis.log
+
+; Functions are analyzed after their callees.
+; CHECK: Final Latency: 246
+; CHECK-NEXT: Final Area: 3
+; CHECK: Final Latency: 18
+; CHECK-NEXT: Final Area: 0
+; CHECK: Final Latency: 278
+; CHECK-NEXT: Final Area: 0
+; CHECK: Number of Functions : 3
+; CHECK-DAG: Loop loop : trip count min 3 avg 3 max 3, parallel iterations 1
+; CHECK-DAG: Loop body : trip count min 10 avg 10 max 10, parallel iterations 1
+; CHECK-DAG: Loop body : trip count min 8 avg 8 max 8, parallel iterations 8
+
+; CONFIG: Examine function: stencil
+; CONFIG: Final optimal basic block configuration.
+; CONFIG-NEXT: Basic Block Configuration:
+; CONFIG-NEXT: entry [1]
+; CONFIG-NEXT: body [1]
+; CONFIG-NEXT: exit [0]
+; CONFIG: Examine function: sum
+; CONFIG: Final optimal basic block configuration.
+; CONFIG-NEXT: Basic Block Configuration:
+; CONFIG-NEXT: entry [1]
+; CONFIG-NEXT: body [8]
+; CONFIG-NEXT: exit [0]
+
+; With -trace-memory the loads and stores are traced as well. An iteration of
+; stencil only reads what the iteration two steps earlier stored, so two
+; iterations overlap, also when repeated iterations are folded together with
+; their accesses.
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument -trace-memory %s -S -o memory.ll
+; RUN: %lli memory.ll > memory.log
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=memory.log %s -disable-output 2>&1 | FileCheck %s --check-prefix=MEMORY
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -loop-fold-iterations=3 -trace-file=memory.log %s -disable-output 2>&1 | FileCheck %s --check-prefix=MEMORY
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-instrument -binary-trace -trace-memory %s -S -o binary-memory.ll
+; RUN: env FPGA_ADVISOR_TRACE_FILE=memory.bin %lli -load %llvmshlibdir/FPGA-Advisor-rt%shlibext binary-memory.ll
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -trace-file=memory.bin %s -disable-output 2>&1 | FileCheck %s --check-prefix=MEMORY
+; RUN: opt -load %llvmshlibdir/LLVMFPGA-Advisor%shlibext -fpga-advisor-analysis -hide-graph -index-trace=memory.idx -trace-file=memory.log %s -disable-output 2>&1 | FileCheck %s --check-prefix=MEMORY
+
+; MEMORY: Final Latency: 126
+; MEMORY-NEXT: Final Area: 5
+; MEMORY: Final Latency: 18
+; MEMORY: Final Latency: 158
+; MEMORY: Loop body : trip count min 10 avg 10 max 10, parallel iterations 2
+
+@a = global [16 x i32] zeroinitializer
+
+define void @stencil(i32* %a, i32 %n) {
+entry:
+  %x0 = load i32* %a
+  %c0 = add i32 %x0, 1
+  br label %body
+
+body:
+  %i = phi i32 [ 2, %entry ], [ %i.next, %body ]
+  %im2 = sub i32 %i, 2
+  %p = getelementptr inbounds i32* %a, i32 %im2
+  %v = load i32* %p
+  %s = add i32 %v, %i
+  %m = mul i32 %s, %c0
+  %r = getelementptr inbounds i32* %a, i32 %i
+  store i32 %m, i32* %r
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %body, label %exit
+
+exit:
+  ret void
+}
+
+define i32 @sum(i32 %x, i32 %n) {
+entry:
+  %c0 = mul i32 %x, 3
+  br label %body
+
+body:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %body ]
+  %t = mul i32 %i, %c0
+  %u = mul i32 %t, %t
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %body, label %exit
+
+exit:
+  ret i32 %u
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %k = phi i32 [ 0, %entry ], [ %k.next, %loop ]
+  call void @stencil(i32* getelementptr inbounds ([16 x i32]* @a, i32 0, i32 0), i32 12)
+  %s = call i32 @sum(i32 %k, i32 8)
+  %k.next = add i32 %k, 1
+  %done = icmp eq i32 %k.next, 3
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 0
+}